@@ -2,24 +2,37 @@
 #include <algorithm>
 #include <cmath>
 #include <numeric>
+#include "./trace.hpp"
 
 using namespace std;
 
-Linear::Linear(int in_features, int out_features)
+Linear::Linear(int in_features, int out_features) : Linear(in_features, out_features, WeightInit::global()) {}
+
+Linear::Linear(int in_features, int out_features, WeightInit &init)
 {
-    weights.resize(out_features, vector<double>(in_features));
-    biases.resize(out_features, 0.0);
-    initialize_weights();
+    initialize_weights(init, in_features, out_features);
 }
 
 vector<double> Linear::forward(const vector<double> &x)
 {
-    vector<double> output(weights.size(), 0.0);
-    for (size_t i = 0; i < weights.size(); ++i)
+    TRACE_SCOPE("Linear::forward", flops(), bytes());
+    vector<double> output(out_features(), 0.0);
+    if (sparse_weights != nullptr)
+    {
+        sparse_weights->forward(x.data(), biases.data(), output.data());
+        return output;
+    }
+    if (kernel != nullptr && kernels::enabled())
     {
-        for (size_t j = 0; j < weights[0].size(); ++j)
+        kernel(weights.data(), biases.data(), x.data(), output.data());
+        return output;
+    }
+    for (size_t i = 0; i < weights.rows(); ++i)
+    {
+        const double *w = weights.row(i);
+        for (size_t j = 0; j < weights.cols(); ++j)
         {
-            output[i] += weights[i][j] * x[j];
+            output[i] += w[j] * x[j];
         }
         output[i] += biases[i];
     }
@@ -28,7 +41,8 @@ vector<double> Linear::forward(const vector<double> &x)
 
 vector<vector<vector<double>>> Linear::forward(const vector<vector<vector<double>>> &x)
 {
-    vector<vector<vector<double>>> output(x.size(), vector<vector<double>>(x[0].size(), vector<double>(weights.size(), 0.0)));
+    TRACE_SCOPE("Linear::forward[BxT]", x.size() * x[0].size() * flops(), x.size() * x[0].size() * bytes());
+    vector<vector<vector<double>>> output(x.size(), vector<vector<double>>(x[0].size(), vector<double>(out_features(), 0.0)));
     for (size_t i = 0; i < x.size(); ++i)
     {
         for (size_t j = 0; j < x[0].size(); ++j)
@@ -39,22 +53,63 @@ vector<vector<vector<double>>> Linear::forward(const vector<vector<vector<double
     return output;
 }
 
-void Linear::initialize_weights()
+int Linear::in_features() const
 {
-    random_device rd;
-    mt19937 gen(rd());
-    normal_distribution<> d(0.0, 0.02);
-    for (auto &row : weights)
+    return sparse_weights != nullptr ? sparse_weights->cols() : weights.cols();
+}
+
+int Linear::out_features() const
+{
+    return biases.size();
+}
+
+double Linear::flops() const
+{
+    if (sparse_weights != nullptr)
     {
-        generate(row.begin(), row.end(), [&]()
-                 { return d(gen); });
+        return 2.0 * sparse_weights->nonzeros();
     }
+    return 2.0 * in_features() * out_features();
+}
+
+double Linear::bytes() const
+{
+    // Sparse: each kept weight also reads its offset byte
+    double weight_bytes = sparse_weights != nullptr ? (sizeof(double) + 1.0) * sparse_weights->nonzeros()
+                                                    : sizeof(double) * static_cast<double>(in_features()) * out_features();
+    return weight_bytes + sizeof(double) * (in_features() + 2.0 * out_features());
+}
+
+ModuleMemory Linear::memory_usage(const string &name) const
+{
+    ModuleMemory w = sparse_weights != nullptr ? sparse_weights->memory_usage(name + ".weights")
+                                               : memory::module(name + ".weights", weights);
+    return memory::combine(name, {w, memory::module(name + ".biases", biases)});
+}
+
+void Linear::prune(int n, int m)
+{
+    if (sparse_weights != nullptr)
+    {
+        return;
+    }
+    sparse_weights = make_shared<const SparseWeights>(SparseWeights::prune(weights, n, m));
+    weights = Parameter();
+    kernel = nullptr;
+}
+
+void Linear::initialize_weights(WeightInit &init, int in_features, int out_features)
+{
+    weights = init.normal(out_features, in_features, 0.0, 0.02);
+    biases = init.constant(1, out_features, 0.0);
+    kernel = kernels::find_linear(in_features, out_features);
 }
 
 Dropout::Dropout(double p) : p(p) {}
 
 vector<double> Dropout::forward(const vector<double> &x)
 {
+    TRACE_SCOPE("Dropout::forward", 2.0 * x.size(), sizeof(double) * 2.0 * x.size());
     vector<double> output = x;
     random_device rd;
     mt19937 gen(rd());
@@ -67,10 +122,45 @@ vector<double> Dropout::forward(const vector<double> &x)
     return output;
 }
 
-Head::Head(int head_size) : key(head_size, head_size), query(head_size, head_size), value(head_size, head_size), dropout(0.2) {}
+Head::Head(int head_size) : Head(head_size, WeightInit::global()) {}
+
+Head::Head(int head_size, WeightInit &init)
+    : key(head_size, head_size, init), query(head_size, head_size, init), value(head_size, head_size, init), dropout(0.2),
+      kernel(kernels::find_head(head_size)) {}
+
+double Head::flops() const
+{
+    return 3.0 * key.flops() + 10.0 * key.out_features();
+}
+
+double Head::bytes() const
+{
+    return 3.0 * key.bytes() + sizeof(double) * 6.0 * key.out_features();
+}
+
+ModuleMemory Head::memory_usage(const string &name) const
+{
+    return memory::combine(name, {key.memory_usage(name + ".key"), query.memory_usage(name + ".query"), value.memory_usage(name + ".value")});
+}
+
+void Head::for_each_linear(const string &name, const LinearVisitor &visit)
+{
+    visit(name + ".key", key);
+    visit(name + ".query", query);
+    visit(name + ".value", value);
+}
 
 vector<double> Head::forward(const vector<double> &x)
 {
+    TRACE_SCOPE("Head::forward", flops(), bytes());
+    if (kernel != nullptr && kernels::enabled() && !key.sparse() && !query.sparse() && !value.sparse())
+    {
+        vector<double> weighted_sum(key.out_features());
+        kernel(key.weight().data(), key.bias().data(), query.weight().data(), query.bias().data(),
+               value.weight().data(), value.bias().data(), x.data(), weighted_sum.data());
+        return dropout.forward(weighted_sum);
+    }
+
     vector<double> k = key.forward(x);
     vector<double> q = query.forward(x);
     vector<double> v = value.forward(x);
@@ -102,16 +192,59 @@ vector<double> Head::forward(const vector<double> &x)
     return dropout.forward(weighted_sum);
 }
 
-MultiHeadAttention::MultiHeadAttention(int n_head, int head_size) : output_linear(n_head * head_size, n_head * head_size)
+MultiHeadAttention::MultiHeadAttention(int n_head, int head_size) : MultiHeadAttention(n_head, head_size, WeightInit::global()) {}
+
+MultiHeadAttention::MultiHeadAttention(int n_head, int head_size, WeightInit &init) : output_linear(n_head * head_size, n_head * head_size, init)
 {
     for (int i = 0; i < n_head; ++i)
     {
-        heads.push_back(Head(head_size));
+        heads.push_back(Head(head_size, init));
+    }
+}
+
+double MultiHeadAttention::flops() const
+{
+    double total = output_linear.flops();
+    for (const auto &head : heads)
+    {
+        total += head.flops();
+    }
+    return total;
+}
+
+double MultiHeadAttention::bytes() const
+{
+    double total = output_linear.bytes();
+    for (const auto &head : heads)
+    {
+        total += head.bytes();
+    }
+    return total;
+}
+
+ModuleMemory MultiHeadAttention::memory_usage(const string &name) const
+{
+    vector<ModuleMemory> parts;
+    for (size_t i = 0; i < heads.size(); ++i)
+    {
+        parts.push_back(heads[i].memory_usage(name + ".heads[" + to_string(i) + "]"));
+    }
+    parts.push_back(output_linear.memory_usage(name + ".output_linear"));
+    return memory::combine(name, parts);
+}
+
+void MultiHeadAttention::for_each_linear(const string &name, const LinearVisitor &visit)
+{
+    for (size_t i = 0; i < heads.size(); ++i)
+    {
+        heads[i].for_each_linear(name + ".heads[" + to_string(i) + "]", visit);
     }
+    visit(name + ".output_linear", output_linear);
 }
 
 vector<double> MultiHeadAttention::forward(const vector<double> &x)
 {
+    TRACE_SCOPE("MultiHeadAttention::forward", flops(), bytes());
     vector<double> concat_heads;
     for (auto &head : heads)
     {
@@ -121,14 +254,36 @@ vector<double> MultiHeadAttention::forward(const vector<double> &x)
     return output_linear.forward(concat_heads);
 }
 
-LayerNorm::LayerNorm(int n_embd) : n_embd(n_embd)
+LayerNorm::LayerNorm(int n_embd) : LayerNorm(n_embd, WeightInit::global()) {}
+
+LayerNorm::LayerNorm(int n_embd, WeightInit &init)
+    : n_embd(n_embd), gamma(init.constant(1, n_embd, 1.0)), beta(init.constant(1, n_embd, 0.0)),
+      kernel(kernels::find_layernorm(n_embd)) {}
+
+double LayerNorm::flops() const
 {
-    gamma.resize(n_embd, 1.0);
-    beta.resize(n_embd, 0.0);
+    return 8.0 * n_embd;
+}
+
+double LayerNorm::bytes() const
+{
+    return sizeof(double) * 4.0 * n_embd;
+}
+
+ModuleMemory LayerNorm::memory_usage(const string &name) const
+{
+    return memory::combine(name, {memory::module(name + ".gamma", gamma), memory::module(name + ".beta", beta)});
 }
 
 vector<double> LayerNorm::forward(const vector<double> &x)
 {
+    TRACE_SCOPE("LayerNorm::forward", flops(), bytes());
+    if (kernel != nullptr && kernels::enabled() && static_cast<int>(x.size()) == n_embd)
+    {
+        vector<double> output(n_embd);
+        kernel(x.data(), gamma.data(), beta.data(), output.data());
+        return output;
+    }
 
     double mean = accumulate(x.begin(), x.end(), 0.0) / x.size();
     double variance = 0.0;
@@ -155,6 +310,7 @@ vector<double> LayerNorm::forward(const vector<double> &x)
 
 vector<vector<vector<double>>> LayerNorm::forward(const vector<vector<vector<double>>> &x)
 {
+    TRACE_SCOPE("LayerNorm::forward[BxT]", x.size() * x[0].size() * flops(), x.size() * x[0].size() * bytes());
     vector<vector<vector<double>>> output = x;
     for (auto &batch : output)
     {
@@ -166,10 +322,42 @@ vector<vector<vector<double>>> LayerNorm::forward(const vector<vector<vector<dou
     return output;
 }
 
-FeedForward::FeedForward(int n_embd) : linear1(n_embd, 4 * n_embd), linear2(4 * n_embd, n_embd) {}
+FeedForward::FeedForward(int n_embd) : FeedForward(n_embd, WeightInit::global()) {}
+
+FeedForward::FeedForward(int n_embd, WeightInit &init)
+    : linear1(n_embd, 4 * n_embd, init), linear2(4 * n_embd, n_embd, init), kernel(kernels::find_feedforward(n_embd)) {}
+
+double FeedForward::flops() const
+{
+    return linear1.flops() + linear1.out_features() + linear2.flops();
+}
+
+double FeedForward::bytes() const
+{
+    return linear1.bytes() + sizeof(double) * 2.0 * linear1.out_features() + linear2.bytes();
+}
+
+ModuleMemory FeedForward::memory_usage(const string &name) const
+{
+    return memory::combine(name, {linear1.memory_usage(name + ".linear1"), linear2.memory_usage(name + ".linear2")});
+}
+
+void FeedForward::for_each_linear(const string &name, const LinearVisitor &visit)
+{
+    visit(name + ".linear1", linear1);
+    visit(name + ".linear2", linear2);
+}
 
 vector<double> FeedForward::forward(const vector<double> &x)
 {
+    TRACE_SCOPE("FeedForward::forward", flops(), bytes());
+    if (kernel != nullptr && kernels::enabled() && !linear1.sparse() && !linear2.sparse())
+    {
+        vector<double> output(linear2.out_features());
+        kernel(linear1.weight().data(), linear1.bias().data(), linear2.weight().data(), linear2.bias().data(),
+               x.data(), output.data());
+        return output;
+    }
     vector<double> hidden = linear1.forward(x);
     for (auto &val : hidden)
     {
@@ -178,10 +366,34 @@ vector<double> FeedForward::forward(const vector<double> &x)
     return linear2.forward(hidden);
 }
 
-Block::Block(int n_embd, int n_head) : sa(n_head, n_embd / n_head), ffwd(n_embd), ln1(n_embd), ln2(n_embd) {}
+Block::Block(int n_embd, int n_head) : Block(n_embd, n_head, WeightInit::global()) {}
+
+Block::Block(int n_embd, int n_head, WeightInit &init) : sa(n_head, n_embd / n_head, init), ffwd(n_embd, init), ln1(n_embd, init), ln2(n_embd, init) {}
+
+double Block::flops() const
+{
+    return ln1.flops() + sa.flops() + ln2.flops() + ffwd.flops();
+}
+
+double Block::bytes() const
+{
+    return ln1.bytes() + sa.bytes() + ln2.bytes() + ffwd.bytes();
+}
+
+vector<ModuleMemory> Block::memory_usage(const string &prefix) const
+{
+    return {sa.memory_usage(prefix + ".sa"), ffwd.memory_usage(prefix + ".ffwd"), ln1.memory_usage(prefix + ".ln1"), ln2.memory_usage(prefix + ".ln2")};
+}
+
+void Block::for_each_linear(const string &prefix, const LinearVisitor &visit)
+{
+    sa.for_each_linear(prefix + ".sa", visit);
+    ffwd.for_each_linear(prefix + ".ffwd", visit);
+}
 
 vector<double> Block::forward(const vector<double> &x)
 {
+    TRACE_SCOPE("Block::forward", flops(), bytes());
     vector<double> x1 = ln1.forward(x);
     vector<double> sa_output = sa.forward(x1);
     vector<double> x2 = ln2.forward(x1);
@@ -196,6 +408,7 @@ vector<double> Block::forward(const vector<double> &x)
 
 vector<vector<double>> Block::forward(const vector<vector<double>> &x)
 {
+    TRACE_SCOPE("Block::forward[B]", x.size() * flops(), x.size() * bytes());
     vector<vector<double>> output = x;
     for (auto &batch : output)
     {
@@ -206,6 +419,7 @@ vector<vector<double>> Block::forward(const vector<vector<double>> &x)
 
 vector<vector<vector<double>>> Block::forward(const vector<vector<vector<double>>> &x)
 {
+    TRACE_SCOPE("Block::forward[BxT]", x.size() * x[0].size() * flops(), x.size() * x[0].size() * bytes());
     vector<vector<vector<double>>> output = x;
     for (auto &batch : output)
     {
@@ -1,8 +1,16 @@
 #ifndef ATTENTIONMECHANISM_HPP
 #define ATTENTIONMECHANISM_HPP
 
+#include <functional>
+#include <memory>
 #include <vector>
 #include <random>
+#include <string>
+#include "./kernels.hpp"
+#include "./memory.hpp"
+#include "./parameter.hpp"
+#include "./sparse.hpp"
+#include "./weightinit.hpp"
 
 using namespace std;
 
@@ -10,15 +18,35 @@ class Linear
 {
 public:
     Linear(int in_features, int out_features);
+    Linear(int in_features, int out_features, WeightInit &init);
     vector<double> forward(const vector<double> &x);
     vector<vector<vector<double>>> forward(const vector<vector<vector<double>>> &x);
+    int in_features() const;
+    int out_features() const;
+    const Parameter &weight() const { return weights; }
+    const Parameter &bias() const { return biases; }
+
+    // Keeps the n largest-magnitude weights of every m (see sparse.hpp) and
+    // drops the dense copy; weight() is empty afterwards
+    void prune(int n, int m);
+    bool sparse() const { return sparse_weights != nullptr; }
+
+    // Work per input vector, as recorded by the trace points
+    double flops() const;
+    double bytes() const;
+    ModuleMemory memory_usage(const string &name) const;
 
 private:
-    void initialize_weights();
-    vector<vector<double>> weights;
-    vector<double> biases;
+    void initialize_weights(WeightInit &init, int in_features, int out_features);
+    Parameter weights; // out_features x in_features
+    Parameter biases;
+    LinearKernel kernel;
+    shared_ptr<const SparseWeights> sparse_weights; // set by prune(); immutable, so copies share it
 };
 
+// Visits every Linear below a module with its memory_usage() name
+using LinearVisitor = function<void(const string &name, Linear &linear)>;
+
 class Dropout
 {
 public:
@@ -33,21 +61,34 @@ class Head
 {
 public:
     Head(int head_size);
+    Head(int head_size, WeightInit &init);
     vector<double> forward(const vector<double> &x);
 
+    double flops() const;
+    double bytes() const;
+    ModuleMemory memory_usage(const string &name) const;
+    void for_each_linear(const string &name, const LinearVisitor &visit);
+
 private:
     Linear key;
     Linear query;
     Linear value;
     Dropout dropout;
+    HeadKernel kernel;
 };
 
 class MultiHeadAttention
 {
 public:
     MultiHeadAttention(int n_head, int head_size);
+    MultiHeadAttention(int n_head, int head_size, WeightInit &init);
     vector<double> forward(const vector<double> &x);
 
+    double flops() const;
+    double bytes() const;
+    ModuleMemory memory_usage(const string &name) const;
+    void for_each_linear(const string &name, const LinearVisitor &visit);
+
 private:
     vector<Head> heads;
     Linear output_linear;
@@ -57,34 +98,53 @@ class LayerNorm
 {
 public:
     LayerNorm(int n_embd);
+    LayerNorm(int n_embd, WeightInit &init);
     vector<double> forward(const vector<double> &x);
     vector<vector<vector<double>>> forward(const vector<vector<vector<double>>> &x);
 
+    double flops() const;
+    double bytes() const;
+    ModuleMemory memory_usage(const string &name) const;
+
 private:
     int n_embd;
-    vector<double> gamma;
-    vector<double> beta;
+    Parameter gamma;
+    Parameter beta;
+    LayerNormKernel kernel;
 };
 
 class FeedForward
 {
 public:
     FeedForward(int n_embd);
+    FeedForward(int n_embd, WeightInit &init);
     vector<double> forward(const vector<double> &x);
 
+    double flops() const;
+    double bytes() const;
+    ModuleMemory memory_usage(const string &name) const;
+    void for_each_linear(const string &name, const LinearVisitor &visit);
+
 private:
     Linear linear1;
     Linear linear2;
+    FeedForwardKernel kernel;
 };
 
 class Block
 {
 public:
     Block(int n_embd, int n_head);
+    Block(int n_embd, int n_head, WeightInit &init);
     vector<double> forward(const vector<double> &x);
     vector<vector<double>> forward(const vector<vector<double>> &x);
     vector<vector<vector<double>>> forward(const vector<vector<vector<double>>> &x);
 
+    double flops() const;
+    double bytes() const;
+    vector<ModuleMemory> memory_usage(const string &prefix) const;
+    void for_each_linear(const string &prefix, const LinearVisitor &visit);
+
 private:
     MultiHeadAttention sa;
     FeedForward ffwd;
@@ -0,0 +1,996 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#endif
+#include "./attentionmechanism.hpp"
+#include "./fixedkernels.hpp"
+#include "./multiheadedgpt.hpp"
+#include "./trace.hpp"
+#include "./util.hpp"
+#include "./weightinit.hpp"
+
+using namespace std;
+
+// Benchmark harness for every layer in attentionmechanism.cpp and the
+// end-to-end paths of GPTLanguageModel. Each benchmark reports achieved
+// GFLOP/s and bytes/s next to a roofline estimate for this host, and the
+// whole run is written as JSON so results can be diffed between builds.
+//
+// FLOP counts describe what the current implementation computes; byte
+// counts are the compulsory traffic of a call (see the cost model below), so
+// achieved GB/s is a lower bound on what the memory system delivered.
+
+struct ShapeConfig
+{
+    int batch_size;
+    int block_size;
+    int n_embd;
+    int n_head;
+    int n_layer;
+    int vocab_size;
+};
+
+struct Cost
+{
+    double flops;
+    double bytes;
+};
+
+struct BenchResult
+{
+    string name;
+    ShapeConfig shape;
+    int iters;
+    double mean_seconds;
+    double min_seconds;
+    Cost cost;
+    double tokens;
+};
+
+struct Roofline
+{
+    double peak_gflops;
+    double peak_gbs;
+};
+
+static volatile double sink = 0.0;
+
+static Cost operator+(const Cost &a, const Cost &b) { return {a.flops + b.flops, a.bytes + b.bytes}; }
+static Cost operator*(double s, const Cost &c) { return {s * c.flops, s * c.bytes}; }
+
+// ---------------------------------------------------------------------------
+// Cost model
+//
+// Bytes are compulsory traffic, which is what the DRAM roof applies to: a call
+// reads each weight once, and each token's input and output activations once.
+// Weight re-reads for later tokens and intermediates that stay in cache are
+// not counted.
+
+// Per token, plus the weight bytes one call reads
+struct TokenCost
+{
+    double flops;
+    double activation_bytes;
+    double weight_bytes;
+};
+
+static TokenCost operator+(const TokenCost &a, const TokenCost &b)
+{
+    return {a.flops + b.flops, a.activation_bytes + b.activation_bytes, a.weight_bytes + b.weight_bytes};
+}
+static TokenCost operator*(double s, const TokenCost &c)
+{
+    return {s * c.flops, s * c.activation_bytes, s * c.weight_bytes};
+}
+
+// A module built from `inner`: its intermediates stay in cache, so only its
+// own in_width inputs and out_width outputs per token reach memory
+static TokenCost composite(const TokenCost &inner, double in_width, double out_width)
+{
+    return {inner.flops, sizeof(double) * (in_width + out_width), inner.weight_bytes};
+}
+
+static Cost callCost(double tokens, const TokenCost &c)
+{
+    return {tokens * c.flops, tokens * c.activation_bytes + c.weight_bytes};
+}
+
+static TokenCost linearCost(double in, double out)
+{
+    return {2.0 * in * out, sizeof(double) * (in + out), sizeof(double) * (in * out + out)};
+}
+
+static TokenCost layerNormCost(double n)
+{
+    // mean, variance, normalize and affine passes
+    return {8.0 * n, sizeof(double) * 2.0 * n, sizeof(double) * 2.0 * n};
+}
+
+static TokenCost headCost(double head_size)
+{
+    TokenCost scores{8.0 * head_size, 0.0, 0.0};
+    return composite(3.0 * linearCost(head_size, head_size) + scores, head_size, head_size);
+}
+
+static TokenCost mhaCost(const ShapeConfig &s)
+{
+    double head_size = s.n_embd / s.n_head;
+    return composite(s.n_head * headCost(head_size) + linearCost(s.n_embd, s.n_embd), s.n_embd, s.n_embd);
+}
+
+static TokenCost feedForwardCost(double n_embd)
+{
+    TokenCost relu{4.0 * n_embd, 0.0, 0.0};
+    return composite(linearCost(n_embd, 4.0 * n_embd) + relu + linearCost(4.0 * n_embd, n_embd), n_embd, n_embd);
+}
+
+static TokenCost blockCost(const ShapeConfig &s)
+{
+    TokenCost residual{2.0 * s.n_embd, 0.0, 0.0};
+    TokenCost inner = 2.0 * layerNormCost(s.n_embd) + mhaCost(s) + feedForwardCost(s.n_embd) + residual;
+    return composite(inner, s.n_embd, s.n_embd);
+}
+
+// Whole batch: B*T tokens through every block, ln_f and lm_head. Each token
+// reads its token and position embedding rows and writes its logits.
+static Cost forwardCost(const ShapeConfig &s, int T)
+{
+    double tokens = static_cast<double>(s.batch_size) * T;
+    TokenCost inner = s.n_layer * blockCost(s) + layerNormCost(s.n_embd) + linearCost(s.n_embd, s.vocab_size);
+    return callCost(tokens, composite(inner, 2.0 * s.n_embd, s.vocab_size));
+}
+
+static Cost lossCost(const ShapeConfig &s)
+{
+    double n = static_cast<double>(s.batch_size) * s.block_size * s.vocab_size;
+    return {6.0 * n, sizeof(double) * n};
+}
+
+static Cost estimateLossCost(const ShapeConfig &s)
+{
+    // estimateLoss runs 10 batches on each of the train and val splits
+    return 20.0 * (forwardCost(s, s.block_size) + lossCost(s));
+}
+
+static Cost generateCost(const ShapeConfig &s, int max_new_tokens)
+{
+    // softmax reads the last logits and writes probs; multinomial reads probs
+    double n = static_cast<double>(s.batch_size) * s.vocab_size;
+    Cost sampling{6.0 * n, sizeof(double) * 3.0 * n};
+    return static_cast<double>(max_new_tokens) * (forwardCost(s, s.block_size) + sampling);
+}
+
+// ---------------------------------------------------------------------------
+// Host roofline
+
+static double seconds_since(chrono::high_resolution_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+}
+
+// Runs fn(thread_index, threads) on every hardware thread at once and returns the wall time
+template <typename F>
+static double onAllThreads(F &&fn)
+{
+    int threads = max(1u, thread::hardware_concurrency());
+    vector<thread> workers;
+    auto start = chrono::high_resolution_clock::now();
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back(fn, t, threads);
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    return seconds_since(start);
+}
+
+// Independent multiply-add chains held in registers, enough of them to cover
+// the FMA latency; returns the flops done
+static double fmaChains(long reps)
+{
+    const int chains = 16;
+    double acc[chains];
+    for (int k = 0; k < chains; ++k)
+    {
+        acc[k] = 1.0 + k;
+    }
+    for (long r = 0; r < reps; ++r)
+    {
+        for (int k = 0; k < chains; ++k)
+        {
+            acc[k] = acc[k] * 0.999999 + 1e-7;
+        }
+    }
+    sink = sink + accumulate(acc, acc + chains, 0.0);
+    return 2.0 * chains * reps;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+// Same with 4-wide fused multiply-adds; only called when the CPU has AVX2 and FMA
+__attribute__((target("avx2,fma"))) static double fmaChainsAvx2(long reps)
+{
+    const int chains = 10;
+    __m256d acc[chains];
+    for (int k = 0; k < chains; ++k)
+    {
+        acc[k] = _mm256_set1_pd(1.0 + k);
+    }
+    const __m256d a = _mm256_set1_pd(0.999999), b = _mm256_set1_pd(1e-7);
+    for (long r = 0; r < reps; ++r)
+    {
+        for (int k = 0; k < chains; ++k)
+        {
+            acc[k] = _mm256_fmadd_pd(acc[k], a, b);
+        }
+    }
+    alignas(32) double lane[4];
+    __m256d total = acc[0];
+    for (int k = 1; k < chains; ++k)
+    {
+        total = _mm256_add_pd(total, acc[k]);
+    }
+    _mm256_store_pd(lane, total);
+    sink = sink + lane[0] + lane[1] + lane[2] + lane[3];
+    return 8.0 * chains * reps;
+}
+
+static bool cpuHasAvx2Fma()
+{
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#else
+static double fmaChainsAvx2(long reps) { return fmaChains(reps); }
+static bool cpuHasAvx2Fma() { return false; }
+#endif
+
+// Compute roof: register-resident multiply-add chains on every hardware thread,
+// fused and 4-wide where the CPU supports it
+static double measurePeakGflops()
+{
+    const long reps = 20000000;
+    bool avx2 = cpuHasAvx2Fma();
+    vector<double> flops(max(1u, thread::hardware_concurrency()), 0.0);
+    double best = numeric_limits<double>::max();
+    for (int trial = 0; trial < 3; ++trial)
+    {
+        best = min(best, onAllThreads([&](int t, int)
+                                      { flops[t] = avx2 ? fmaChainsAvx2(reps) : fmaChains(reps); }));
+    }
+    return accumulate(flops.begin(), flops.end(), 0.0) / best / 1e9;
+}
+
+// Bandwidth roof: STREAM-style triad over arrays larger than the last-level
+// cache, split across every hardware thread
+static double measurePeakGbs()
+{
+    const size_t n = 4 * 1024 * 1024;
+    const int reps = 10;
+    vector<double> a(n, 0.0), b(n, 1.0), c(n, 2.0);
+    double best = numeric_limits<double>::max();
+    for (int r = 0; r < reps; ++r)
+    {
+        best = min(best, onAllThreads([&](int t, int threads)
+                                      {
+                                          size_t lo = n * t / threads, hi = n * (t + 1) / threads;
+                                          for (size_t i = lo; i < hi; ++i)
+                                          {
+                                              a[i] = b[i] + 0.5 * c[i];
+                                          }
+                                      }));
+        sink = sink + a[r];
+    }
+    return 3.0 * sizeof(double) * n / best / 1e9;
+}
+
+// ---------------------------------------------------------------------------
+// Runner
+
+template <typename F>
+static BenchResult runBench(const string &name, const ShapeConfig &shape, Cost cost, double tokens,
+                            double min_time, bool warmup, F &&fn)
+{
+    if (warmup)
+    {
+        fn();
+    }
+    int iters = 0;
+    double total = 0.0;
+    double best = numeric_limits<double>::max();
+    while (iters == 0 || total < min_time)
+    {
+        auto start = chrono::high_resolution_clock::now();
+        fn();
+        double dt = seconds_since(start);
+        best = min(best, dt);
+        total += dt;
+        ++iters;
+    }
+    return {name, shape, iters, total / iters, best, cost, tokens};
+}
+
+static vector<vector<vector<double>>> randomActivations(int B, int T, int C, mt19937 &gen)
+{
+    normal_distribution<> d(0.0, 1.0);
+    vector<vector<vector<double>>> x(B, vector<vector<double>>(T, vector<double>(C)));
+    for (auto &batch : x)
+    {
+        for (auto &row : batch)
+        {
+            generate(row.begin(), row.end(), [&]()
+                     { return d(gen); });
+        }
+    }
+    return x;
+}
+
+static vector<vector<int>> randomTokens(int rows, int cols, int vocab, mt19937 &gen)
+{
+    uniform_int_distribution<> d(0, vocab - 1);
+    vector<vector<int>> tokens(rows, vector<int>(cols));
+    for (auto &row : tokens)
+    {
+        generate(row.begin(), row.end(), [&]()
+                 { return d(gen); });
+    }
+    return tokens;
+}
+
+// Apply a single-vector forward to every token of a B x T x C activation
+template <typename Layer>
+static void forEachToken(Layer &layer, const vector<vector<vector<double>>> &x)
+{
+    for (const auto &batch : x)
+    {
+        for (const auto &row : batch)
+        {
+            vector<double> out = layer.forward(row);
+            sink = sink + out[0];
+        }
+    }
+}
+
+static bool wants(const vector<string> &benches, const string &name)
+{
+    return find(benches.begin(), benches.end(), name) != benches.end();
+}
+
+static void runShape(const ShapeConfig &s, const vector<string> &benches, int max_new_tokens, double min_time,
+                     vector<BenchResult> &results)
+{
+    mt19937 gen(1234);
+    int B = s.batch_size, T = s.block_size, C = s.n_embd;
+    int head_size = C / s.n_head;
+    double tokens = static_cast<double>(B) * T;
+    auto x = randomActivations(B, T, C, gen);
+
+    if (wants(benches, "linear"))
+    {
+        Linear qkv(head_size, head_size);
+        Linear proj(C, C);
+        Linear up(C, 4 * C);
+        Linear down(4 * C, C);
+        auto hidden = randomActivations(B, T, 4 * C, gen);
+        results.push_back(runBench("linear_qkv", s, callCost(tokens, linearCost(head_size, head_size)), tokens, min_time, true,
+                                   [&]()
+                                   { forEachToken(qkv, x); }));
+        results.push_back(runBench("linear_proj", s, callCost(tokens, linearCost(C, C)), tokens, min_time, true,
+                                   [&]()
+                                   { sink = sink + proj.forward(x)[0][0][0]; }));
+        results.push_back(runBench("linear_ffn_up", s, callCost(tokens, linearCost(C, 4 * C)), tokens, min_time, true,
+                                   [&]()
+                                   { sink = sink + up.forward(x)[0][0][0]; }));
+        results.push_back(runBench("linear_ffn_down", s, callCost(tokens, linearCost(4 * C, C)), tokens, min_time, true,
+                                   [&]()
+                                   { sink = sink + down.forward(hidden)[0][0][0]; }));
+    }
+    if (wants(benches, "lm_head"))
+    {
+        Linear lm_head(C, s.vocab_size);
+        results.push_back(runBench("lm_head", s, callCost(tokens, linearCost(C, s.vocab_size)), tokens, min_time, true,
+                                   [&]()
+                                   { sink = sink + lm_head.forward(x)[0][0][0]; }));
+    }
+    if (wants(benches, "layernorm"))
+    {
+        LayerNorm ln(C);
+        results.push_back(runBench("layernorm", s, callCost(tokens, layerNormCost(C)), tokens, min_time, true,
+                                   [&]()
+                                   { sink = sink + ln.forward(x)[0][0][0]; }));
+    }
+    if (wants(benches, "head"))
+    {
+        Head head(head_size);
+        results.push_back(runBench("head", s, callCost(tokens, headCost(head_size)), tokens, min_time, true,
+                                   [&]()
+                                   { forEachToken(head, x); }));
+    }
+    if (wants(benches, "mha"))
+    {
+        MultiHeadAttention mha(s.n_head, head_size);
+        results.push_back(runBench("mha", s, callCost(tokens, mhaCost(s)), tokens, min_time, true,
+                                   [&]()
+                                   { forEachToken(mha, x); }));
+    }
+    if (wants(benches, "feedforward"))
+    {
+        FeedForward ffwd(C);
+        results.push_back(runBench("feedforward", s, callCost(tokens, feedForwardCost(C)), tokens, min_time, true,
+                                   [&]()
+                                   { forEachToken(ffwd, x); }));
+    }
+    if (wants(benches, "block"))
+    {
+        Block block(C, s.n_head);
+        results.push_back(runBench("block", s, callCost(tokens, blockCost(s)), tokens, min_time, true,
+                                   [&]()
+                                   { sink = sink + block.forward(x)[0][0][0]; }));
+    }
+
+    bool end_to_end = wants(benches, "forward") || wants(benches, "estimateLoss") || wants(benches, "generate");
+    if (!end_to_end)
+    {
+        return;
+    }
+
+    // The end-to-end paths read the globals from util.cpp
+    vocab_size = s.vocab_size;
+    batch_size = B;
+    block_size = T;
+    GPTLanguageModel model(s.vocab_size, C, T, s.n_layer, s.n_head);
+
+    if (wants(benches, "forward"))
+    {
+        auto idx = randomTokens(B, T, s.vocab_size, gen);
+        results.push_back(runBench("forward", s, forwardCost(s, T), tokens, min_time, false,
+                                   [&]()
+                                   { sink = sink + model.forward(idx).first[0][0][0]; }));
+    }
+    if (wants(benches, "estimateLoss"))
+    {
+        // getBatch samples block_size + 1 consecutive tokens from a row
+        train_data = randomTokens(2 * T + 1, T + 1, s.vocab_size, gen);
+        val_data = randomTokens(2 * T + 1, T + 1, s.vocab_size, gen);
+        srand(1234);
+        results.push_back(runBench("estimateLoss", s, estimateLossCost(s), 20.0 * tokens, min_time, false,
+                                   [&]()
+                                   { sink = sink + estimateLoss(model)["val"]; }));
+    }
+    if (wants(benches, "generate"))
+    {
+        auto context = randomTokens(B, T, s.vocab_size, gen);
+        double new_tokens = static_cast<double>(B) * max_new_tokens;
+        results.push_back(runBench("generate", s, generateCost(s, max_new_tokens), new_tokens, min_time, false,
+                                   [&]()
+                                   {
+                                       vector<vector<int>> idx = context;
+                                       sink = sink + model.generate(idx, max_new_tokens)[0].back();
+                                   }));
+    }
+}
+
+// Same rule as GPTLanguageModel::prune
+static bool matchesTarget(const string &name, const vector<string> &targets)
+{
+    return any_of(targets.begin(), targets.end(), [&](const string &t)
+                  { return name.find(t) != string::npos; });
+}
+
+// Whether n:m is valid and fits every Linear of an n_embd x n_head model
+// that the targets select; reports the first misfit
+static bool sparsityFits(int n, int m, int C, int H, const vector<string> &targets)
+{
+    string misfit;
+    auto fits = [&](const string &name, size_t cols)
+    {
+        try
+        {
+            SparseWeights::check_pattern(n, m, cols);
+        }
+        catch (const invalid_argument &e)
+        {
+            misfit = name + ": " + e.what();
+        }
+        return misfit.empty();
+    };
+    LinearVisitor check = [&](const string &name, Linear &linear)
+    {
+        if (misfit.empty() && matchesTarget(name, targets))
+        {
+            fits(name, linear.in_features());
+        }
+    };
+    if (!fits("pattern", max(m, 1)))
+    {
+        cerr << "--sparsity " << n << ":" << m << ": " << misfit << endl;
+        return false;
+    }
+    Block block(C, H);
+    block.for_each_linear("blocks[0]", check);
+    Linear lm_head(C, 1);
+    check("lm_head", lm_head);
+    if (!misfit.empty())
+    {
+        cerr << "--sparsity " << n << ":" << m << " with n_embd=" << C << ": " << misfit << endl;
+    }
+    return misfit.empty();
+}
+
+// Dense against n:m-pruned weights: kernel and end-to-end speedup, parameter
+// memory, and the estimateLoss change. Sparse results keep the dense cost, so
+// their GFLOP/s are effective (dense-equivalent) rates. The standalone FFN
+// layers go by their in-block names, ffwd.linear1 and ffwd.linear2, and only
+// those the targets select are pruned and benchmarked.
+static void runSparsity(const ShapeConfig &s, int n, int m, const vector<string> &targets, double min_time,
+                        vector<BenchResult> &results, ostream &report)
+{
+    mt19937 gen(1234);
+    int B = s.batch_size, T = s.block_size, C = s.n_embd;
+    double tokens = static_cast<double>(B) * T;
+    auto x = randomActivations(B, T, C, gen);
+    auto hidden = randomActivations(B, T, 4 * C, gen);
+    // Speedup rows: name and the index of its dense result; sparse follows
+    vector<pair<string, size_t>> pairs;
+
+    bool prune_up = matchesTarget("ffwd.linear1", targets);
+    bool prune_down = matchesTarget("ffwd.linear2", targets);
+    if (prune_up)
+    {
+        Linear up(C, 4 * C);
+        Linear sparse_up = up;
+        sparse_up.prune(n, m);
+        pairs.push_back({"linear_ffn_up", results.size()});
+        for (Linear *u : {&up, &sparse_up})
+        {
+            results.push_back(runBench(string("linear_ffn_up") + (u->sparse() ? "/sparse" : "/dense"), s,
+                                       callCost(tokens, linearCost(C, 4 * C)), tokens, min_time, true, [&]()
+                                       { forEachToken(*u, x); }));
+        }
+    }
+    if (prune_down)
+    {
+        Linear down(4 * C, C);
+        Linear sparse_down = down;
+        sparse_down.prune(n, m);
+        pairs.push_back({"linear_ffn_down", results.size()});
+        for (Linear *d : {&down, &sparse_down})
+        {
+            results.push_back(runBench(string("linear_ffn_down") + (d->sparse() ? "/sparse" : "/dense"), s,
+                                       callCost(tokens, linearCost(4 * C, C)), tokens, min_time, true, [&]()
+                                       { forEachToken(*d, hidden); }));
+        }
+    }
+    if (prune_up || prune_down)
+    {
+        FeedForward ffwd(C);
+        FeedForward sparse_ffwd = ffwd;
+        sparse_ffwd.for_each_linear("ffwd", [&](const string &name, Linear &linear)
+                                    {
+                                        if (matchesTarget(name, targets))
+                                        {
+                                            linear.prune(n, m);
+                                        }
+                                    });
+        pairs.push_back({"feedforward", results.size()});
+        results.push_back(runBench("feedforward/dense", s, callCost(tokens, feedForwardCost(C)), tokens, min_time, true,
+                                   [&]()
+                                   { forEachToken(ffwd, x); }));
+        results.push_back(runBench("feedforward/sparse", s, callCost(tokens, feedForwardCost(C)), tokens, min_time,
+                                   true, [&]()
+                                   { forEachToken(sparse_ffwd, x); }));
+    }
+
+    vocab_size = s.vocab_size;
+    batch_size = B;
+    block_size = T;
+    GPTLanguageModel dense(s.vocab_size, C, T, s.n_layer, s.n_head);
+    GPTLanguageModel pruned(s.vocab_size, C, T, s.n_layer, s.n_head);
+    int layers = pruned.prune(n, m, targets);
+    auto idx = randomTokens(B, T, s.vocab_size, gen);
+    pairs.push_back({"forward", results.size()});
+    results.push_back(runBench("forward/dense", s, forwardCost(s, T), tokens, min_time, false,
+                               [&]()
+                               { sink = sink + dense.forward(idx).first[0][0][0]; }));
+    results.push_back(runBench("forward/sparse", s, forwardCost(s, T), tokens, min_time, false,
+                               [&]()
+                               { sink = sink + pruned.forward(idx).first[0][0][0]; }));
+
+    // Whole model from the memory report; pruned modules from the same
+    // Linears prune() matched
+    auto parameter_bytes = [&](const GPTLanguageModel &model)
+    {
+        size_t total = 0;
+        for (const auto &module : model.memory_report(B, T).modules)
+        {
+            total += module.payload_bytes + module.overhead_bytes;
+        }
+        return total;
+    };
+    auto targeted_bytes = [&](GPTLanguageModel &model)
+    {
+        size_t total = 0;
+        model.for_each_linear([&](const string &name, Linear &linear)
+                              {
+                                  if (matchesTarget(name, targets))
+                                  {
+                                      ModuleMemory usage = linear.memory_usage(name);
+                                      total += usage.payload_bytes + usage.overhead_bytes;
+                                  }
+                              });
+        return total;
+    };
+    size_t dense_bytes = parameter_bytes(dense);
+    size_t sparse_bytes = parameter_bytes(pruned);
+    size_t dense_targeted = targeted_bytes(dense);
+    size_t sparse_targeted = targeted_bytes(pruned);
+
+    // Same batches for every evaluation; Head dropout stays active in forward,
+    // so a second dense evaluation gives the noise floor
+    train_data = randomTokens(2 * T + 1, T + 1, s.vocab_size, gen);
+    val_data = randomTokens(2 * T + 1, T + 1, s.vocab_size, gen);
+    srand(1234);
+    double dense_loss = estimateLoss(dense)["val"];
+    srand(1234);
+    double repeat_loss = estimateLoss(dense)["val"];
+    srand(1234);
+    double sparse_loss = estimateLoss(pruned)["val"];
+
+    report << "sparsity " << n << ":" << m << " on " << layers << " Linear layers" << endl;
+    report << "speedup of sparse over dense (min time):" << endl;
+    ios saved(nullptr);
+    saved.copyfmt(report);
+    for (const auto &[name, dense_index] : pairs)
+    {
+        report << "  " << left << setw(20) << name << right << fixed << setprecision(2)
+               << results[dense_index].min_seconds / results[dense_index + 1].min_seconds << "x" << endl;
+    }
+    report << "parameters: dense " << dense_bytes / (1024.0 * 1024.0) << " MiB, sparse "
+           << sparse_bytes / (1024.0 * 1024.0) << " MiB, saved " << (dense_bytes - sparse_bytes) / (1024.0 * 1024.0)
+           << " MiB (" << 100.0 * (dense_bytes - sparse_bytes) / dense_bytes << "%)" << endl;
+    if (dense_targeted > 0)
+    {
+        report << "pruned modules: dense " << dense_targeted / (1024.0 * 1024.0) << " MiB, sparse "
+               << sparse_targeted / (1024.0 * 1024.0) << " MiB ("
+               << 100.0 * (dense_targeted - sparse_targeted) / dense_targeted << "% saved)" << endl;
+    }
+    report << setprecision(4) << "estimateLoss val: dense " << dense_loss << ", sparse " << sparse_loss << ", delta "
+           << showpos << sparse_loss - dense_loss << noshowpos << " (dense repeat " << repeat_loss << ")" << endl;
+    report.copyfmt(saved);
+}
+
+// ---------------------------------------------------------------------------
+// Weight init reproducibility
+
+// The same tensor filled on 1 thread and on several must match bit for bit.
+// Large enough that each thread count below gets that many ranges (at least
+// 32768 elements each), with odd range lengths so every other range starts
+// mid Box-Muller pair.
+static bool checkInitThreads(ostream &report)
+{
+    const size_t rows = 449, cols = 521;
+    Parameter serial = WeightInit(1234, 1).normal(rows, cols, 0.0, 0.02);
+    bool identical = true;
+    for (int threads : {2, 3, 4, 7})
+    {
+        Parameter parallel = WeightInit(1234, threads).normal(rows, cols, 0.0, 0.02);
+        bool same = memcmp(serial.data(), parallel.data(), serial.size() * sizeof(double)) == 0;
+        report << "weight init on " << threads << " threads: " << (same ? "identical to" : "DIFFERS from")
+               << " 1 thread" << endl;
+        identical = identical && same;
+    }
+    return identical;
+}
+
+// ---------------------------------------------------------------------------
+// Reporting
+
+static double achievedGflops(const BenchResult &r) { return r.cost.flops / r.mean_seconds / 1e9; }
+static double achievedGbs(const BenchResult &r) { return r.cost.bytes / r.mean_seconds / 1e9; }
+static double intensity(const BenchResult &r) { return r.cost.flops / r.cost.bytes; }
+static double rooflineGflops(const BenchResult &r, const Roofline &roof)
+{
+    return min(roof.peak_gflops, intensity(r) * roof.peak_gbs);
+}
+
+// A result can only beat the roof when the byte model undercounts (e.g. a
+// working set reused across calls from cache); such results are flagged and
+// reported at 100%
+static bool aboveRoof(const BenchResult &r, const Roofline &roof) { return achievedGflops(r) > rooflineGflops(r, roof); }
+static double roofPercent(const BenchResult &r, const Roofline &roof)
+{
+    return min(100.0, 100.0 * achievedGflops(r) / rooflineGflops(r, roof));
+}
+
+static void printTable(ostream &out, const vector<BenchResult> &results, const Roofline &roof)
+{
+    out << left << setw(16) << "bench" << right << setw(5) << "B" << setw(5) << "T" << setw(6) << "C"
+        << setw(4) << "H" << setw(4) << "L" << setw(7) << "iters" << setw(12) << "ms" << setw(10) << "GFLOP/s"
+        << setw(10) << "GB/s" << setw(8) << "AI" << setw(10) << "roof%" << setw(12) << "tok/s" << endl;
+    ios saved(nullptr);
+    saved.copyfmt(out);
+    for (const auto &r : results)
+    {
+        out << left << setw(16) << r.name << right << setw(5) << r.shape.batch_size << setw(5) << r.shape.block_size
+            << setw(6) << r.shape.n_embd << setw(4) << r.shape.n_head << setw(4) << r.shape.n_layer
+            << setw(7) << r.iters << fixed << setprecision(3) << setw(12) << r.mean_seconds * 1e3
+            << setprecision(2) << setw(10) << achievedGflops(r) << setw(10) << achievedGbs(r)
+            << setw(8) << intensity(r) << setw(9) << roofPercent(r, roof) << (aboveRoof(r, roof) ? "*" : "%")
+            << setprecision(1) << setw(12) << r.tokens / r.mean_seconds << endl;
+    }
+    out.copyfmt(saved);
+}
+
+static void writeJson(const string &path, const vector<BenchResult> &results, const Roofline &roof)
+{
+    ofstream out(path);
+    out << setprecision(9);
+    out << "{\n";
+    out << "  \"timestamp\": " << time(nullptr) << ",\n";
+    out << "  \"roofline\": {\"peak_gflops\": " << roof.peak_gflops << ", \"peak_gbs\": " << roof.peak_gbs << "},\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const auto &r = results[i];
+        out << "    {\"name\": \"" << r.name << "\""
+            << ", \"batch_size\": " << r.shape.batch_size
+            << ", \"block_size\": " << r.shape.block_size
+            << ", \"n_embd\": " << r.shape.n_embd
+            << ", \"n_head\": " << r.shape.n_head
+            << ", \"n_layer\": " << r.shape.n_layer
+            << ", \"vocab_size\": " << r.shape.vocab_size
+            << ", \"iters\": " << r.iters
+            << ", \"mean_seconds\": " << r.mean_seconds
+            << ", \"min_seconds\": " << r.min_seconds
+            << ", \"flops\": " << r.cost.flops
+            << ", \"bytes\": " << r.cost.bytes
+            << ", \"gflops\": " << achievedGflops(r)
+            << ", \"gbs\": " << achievedGbs(r)
+            << ", \"intensity\": " << intensity(r)
+            << ", \"roofline_gflops\": " << rooflineGflops(r, roof)
+            << ", \"roof_percent\": " << roofPercent(r, roof)
+            << ", \"above_roof\": " << (aboveRoof(r, roof) ? "true" : "false")
+            << ", \"tokens_per_sec\": " << r.tokens / r.mean_seconds
+            << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+// ---------------------------------------------------------------------------
+// Command line
+
+static vector<string> splitList(const string &s)
+{
+    vector<string> items;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        if (!item.empty())
+        {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+static vector<int> parseInts(const string &s)
+{
+    vector<int> values;
+    for (const auto &item : splitList(s))
+    {
+        values.push_back(stoi(item));
+    }
+    return values;
+}
+
+static void usage()
+{
+    cerr << "usage: benchmark [options]\n"
+         << "  --batch_size LIST    comma separated values to sweep (default from util.cpp)\n"
+         << "  --block_size LIST\n"
+         << "  --n_embd LIST\n"
+         << "  --n_head LIST\n"
+         << "  --n_layer LIST\n"
+         << "  --vocab_size N       synthetic vocabulary size (default 2048)\n"
+         << "  --quick              divide the util.cpp defaults by 4\n"
+         << "  --benches LIST       linear,lm_head,layernorm,head,mha,feedforward,block,\n"
+         << "                       forward,estimateLoss,generate (default all)\n"
+         << "  --max_new_tokens N   tokens per generate() call (default 4)\n"
+         << "  --min_time S         minimum seconds per benchmark (default 0.5)\n"
+         << "  --peak_gflops X      skip measuring the compute roof\n"
+         << "  --peak_gbs X         skip measuring the bandwidth roof\n"
+         << "  --json PATH          output file (default bench_results.json)\n"
+         << "  --compare_kernels    run every shape with the runtime loops and then with the\n"
+         << "                       shape-specialized kernels, and report the speedup\n"
+         << "  --sparsity N:M       instead of the benches above, compare dense weights against\n"
+         << "                       N:M magnitude-pruned ones (speedup, memory, estimateLoss)\n"
+         << "  --sparse_layers LIST Linear layers to prune by name, e.g. ffwd,sa,lm_head\n"
+         << "                       (default ffwd)\n"
+         << "  --check_init         only check that weight init is identical on 1 and N threads\n"
+         << "  --trace PATH         write a Chrome trace and per-layer summary\n"
+         << "                       (needs a GPT_ENABLE_TRACE build)\n";
+}
+
+int main(int argc, char **argv)
+{
+    vector<int> batch_sizes = {batch_size};
+    vector<int> block_sizes = {block_size};
+    vector<int> n_embds = {n_embd};
+    vector<int> n_heads = {n_head};
+    vector<int> n_layers = {n_layer};
+    int synthetic_vocab = 2048;
+    vector<string> benches = {"linear", "lm_head", "layernorm", "head", "mha", "feedforward", "block",
+                              "forward", "estimateLoss", "generate"};
+    int max_new_tokens = 4;
+    double min_time = 0.5;
+    Roofline roof = {0.0, 0.0};
+    string json_path = "bench_results.json";
+    string trace_path;
+    bool compare_kernels = false;
+    bool sparsity = false;
+    int sparse_n = 0, sparse_m = 0;
+    vector<string> sparse_layers = {"ffwd"};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--quick")
+        {
+            batch_sizes = {max(1, batch_size / 4)};
+            block_sizes = {max(1, block_size / 4)};
+            n_embds = {max(n_head, n_embd / 4)};
+            n_layers = {max(1, n_layer / 4)};
+            continue;
+        }
+        if (arg == "--compare_kernels")
+        {
+            compare_kernels = true;
+            continue;
+        }
+        if (arg == "--check_init")
+        {
+            return checkInitThreads(cout) ? 0 : 1;
+        }
+        if (arg == "--help" || i + 1 >= argc)
+        {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+        string value = argv[++i];
+        if (arg == "--batch_size") batch_sizes = parseInts(value);
+        else if (arg == "--block_size") block_sizes = parseInts(value);
+        else if (arg == "--n_embd") n_embds = parseInts(value);
+        else if (arg == "--n_head") n_heads = parseInts(value);
+        else if (arg == "--n_layer") n_layers = parseInts(value);
+        else if (arg == "--vocab_size") synthetic_vocab = stoi(value);
+        else if (arg == "--benches") benches = splitList(value);
+        else if (arg == "--max_new_tokens") max_new_tokens = stoi(value);
+        else if (arg == "--min_time") min_time = stod(value);
+        else if (arg == "--peak_gflops") roof.peak_gflops = stod(value);
+        else if (arg == "--peak_gbs") roof.peak_gbs = stod(value);
+        else if (arg == "--json") json_path = value;
+        else if (arg == "--trace") trace_path = value;
+        else if (arg == "--sparsity" && sscanf(value.c_str(), "%d:%d", &sparse_n, &sparse_m) == 2) sparsity = true;
+        else if (arg == "--sparse_layers") sparse_layers = splitList(value);
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (sparsity)
+    {
+        bool fits = true;
+        for (int C : n_embds)
+            for (int H : n_heads)
+            {
+                fits = fits && (H <= 0 || C % H != 0 || sparsityFits(sparse_n, sparse_m, C, H, sparse_layers));
+            }
+        if (!fits)
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    // The model code reports progress on cout; keep the report readable
+    ostream report(cout.rdbuf());
+    ostringstream chatter;
+    cout.rdbuf(chatter.rdbuf());
+
+    if (roof.peak_gflops <= 0.0)
+    {
+        roof.peak_gflops = measurePeakGflops();
+    }
+    if (roof.peak_gbs <= 0.0)
+    {
+        roof.peak_gbs = measurePeakGbs();
+    }
+    report << "roofline: " << roof.peak_gflops << " GFLOP/s, " << roof.peak_gbs << " GB/s" << endl;
+
+    // Specialize the --quick shape as well as the built-in production one
+    fixedshape::register_model<96, 6>();
+
+    vector<BenchResult> results;
+    for (int B : batch_sizes)
+        for (int T : block_sizes)
+            for (int C : n_embds)
+                for (int H : n_heads)
+                    for (int L : n_layers)
+                    {
+                        if (H <= 0 || C % H != 0)
+                        {
+                            cerr << "skipping n_embd=" << C << " n_head=" << H << ": n_embd must divide evenly" << endl;
+                            continue;
+                        }
+                        ShapeConfig shape = {B, T, C, H, L, synthetic_vocab};
+                        size_t first = results.size();
+                        if (sparsity)
+                        {
+                            runSparsity(shape, sparse_n, sparse_m, sparse_layers, min_time, results, report);
+                            chatter.str("");
+                            printTable(report, vector<BenchResult>(results.begin() + first, results.end()), roof);
+                        }
+                        else if (compare_kernels)
+                        {
+                            kernels::set_enabled(false);
+                            runShape(shape, benches, max_new_tokens, min_time, results);
+                            size_t split = results.size();
+                            kernels::set_enabled(true);
+                            runShape(shape, benches, max_new_tokens, min_time, results);
+                            for (size_t r = first; r < split; ++r)
+                            {
+                                results[r].name += "/runtime";
+                                results[split + r - first].name += "/fixed";
+                            }
+                            chatter.str("");
+                            printTable(report, vector<BenchResult>(results.begin() + first, results.end()), roof);
+                            report << "speedup of fixed over runtime (min time):" << endl;
+                            ios saved(nullptr);
+                            saved.copyfmt(report);
+                            for (size_t r = first; r < split; ++r)
+                            {
+                                const BenchResult &specialized = results[split + r - first];
+                                report << "  " << left << setw(20) << specialized.name.substr(0, specialized.name.size() - 6)
+                                       << right << setprecision(2) << fixed
+                                       << results[r].min_seconds / specialized.min_seconds << "x" << endl;
+                            }
+                            report.copyfmt(saved);
+                        }
+                        else
+                        {
+                            runShape(shape, benches, max_new_tokens, min_time, results);
+                            chatter.str("");
+                            printTable(report, vector<BenchResult>(results.begin() + first, results.end()), roof);
+                        }
+                        report << endl;
+                    }
+
+    cout.rdbuf(report.rdbuf());
+    writeJson(json_path, results, roof);
+    cout << "wrote " << results.size() << " results to " << json_path << endl;
+    if (!trace_path.empty())
+    {
+        trace::write_chrome_trace(trace_path);
+        trace::print_summary(cout);
+        cout << "wrote trace to " << trace_path << endl;
+    }
+    return 0;
+}
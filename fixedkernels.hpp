@@ -0,0 +1,152 @@
+#ifndef FIXEDKERNELS_HPP
+#define FIXEDKERNELS_HPP
+
+#include <array>
+#include <cmath>
+#include "./kernels.hpp"
+
+using namespace std;
+
+// Forward kernels with every dimension a template parameter, so loop bounds
+// are constants, scratch buffers are fixed-size aligned arrays and there is
+// no remainder handling.
+//
+// Dot products and reductions keep `lanes` independent partial sums, which
+// the compiler can map onto SIMD registers without -ffast-math. The sums are
+// therefore associated differently from the runtime loops and can differ in
+// the last bits.
+
+namespace fixedshape
+{
+    constexpr int lanes = 8;
+
+    template <int N>
+    inline double dot(const double *a, const double *b)
+    {
+        static_assert(N % lanes == 0, "specialized sizes must be a multiple of fixedshape::lanes");
+        double acc[lanes] = {};
+        for (int j = 0; j < N; j += lanes)
+        {
+            for (int k = 0; k < lanes; ++k)
+            {
+                acc[k] += a[j + k] * b[j + k];
+            }
+        }
+        double sum = 0.0;
+        for (int k = 0; k < lanes; ++k)
+        {
+            sum += acc[k];
+        }
+        return sum;
+    }
+
+    template <int In, int Out>
+    void linear(const double *w, const double *b, const double *x, double *y)
+    {
+        for (int o = 0; o < Out; ++o)
+        {
+            y[o] = dot<In>(w + o * In, x) + b[o];
+        }
+    }
+
+    template <int N>
+    void layernorm(const double *x, const double *gamma, const double *beta, double *y)
+    {
+        static_assert(N % lanes == 0, "specialized sizes must be a multiple of fixedshape::lanes");
+        double acc[lanes] = {};
+        for (int j = 0; j < N; j += lanes)
+        {
+            for (int k = 0; k < lanes; ++k)
+            {
+                acc[k] += x[j + k];
+            }
+        }
+        double mean = 0.0;
+        for (int k = 0; k < lanes; ++k)
+        {
+            mean += acc[k];
+            acc[k] = 0.0;
+        }
+        mean /= N;
+
+        for (int j = 0; j < N; j += lanes)
+        {
+            for (int k = 0; k < lanes; ++k)
+            {
+                double d = x[j + k] - mean;
+                acc[k] += d * d;
+            }
+        }
+        double variance = 0.0;
+        for (int k = 0; k < lanes; ++k)
+        {
+            variance += acc[k];
+        }
+        double inv_stddev = 1.0 / sqrt(variance / N + 1e-5);
+
+        for (int i = 0; i < N; ++i)
+        {
+            y[i] = gamma[i] * ((x[i] - mean) * inv_stddev) + beta[i];
+        }
+    }
+
+    // Head::forward before dropout: key/query/value projections of the first
+    // HeadSize inputs, then the element-wise score softmax
+    template <int HeadSize>
+    void head(const double *wk, const double *bk, const double *wq, const double *bq,
+              const double *wv, const double *bv, const double *x, double *y)
+    {
+        alignas(64) array<double, HeadSize> k, q, v, scores;
+        linear<HeadSize, HeadSize>(wk, bk, x, k.data());
+        linear<HeadSize, HeadSize>(wq, bq, x, q.data());
+        linear<HeadSize, HeadSize>(wv, bv, x, v.data());
+
+        const double scale = 1.0 / sqrt(static_cast<double>(HeadSize));
+        double max_score = q[0] * k[0] * scale;
+        for (int i = 0; i < HeadSize; ++i)
+        {
+            scores[i] = q[i] * k[i] * scale;
+            max_score = scores[i] > max_score ? scores[i] : max_score;
+        }
+        double sum_scores = 0.0;
+        for (int i = 0; i < HeadSize; ++i)
+        {
+            scores[i] = exp(scores[i] - max_score);
+            sum_scores += scores[i];
+        }
+        for (int i = 0; i < HeadSize; ++i)
+        {
+            y[i] = scores[i] / sum_scores * v[i];
+        }
+    }
+
+    template <int NEmbd>
+    void feedforward(const double *w1, const double *b1, const double *w2, const double *b2,
+                     const double *x, double *y)
+    {
+        alignas(64) array<double, 4 * NEmbd> hidden;
+        linear<NEmbd, 4 * NEmbd>(w1, b1, x, hidden.data());
+        for (auto &val : hidden)
+        {
+            val = val > 0.0 ? val : 0.0; // ReLU activation
+        }
+        linear<4 * NEmbd, NEmbd>(w2, b2, hidden.data(), y);
+    }
+
+    // Every per-vector shape used by a Block with this n_embd and n_head
+    template <int NEmbd, int NHead>
+    void register_model()
+    {
+        static_assert(NEmbd % NHead == 0, "n_embd must be divisible by n_head");
+        constexpr int head_size = NEmbd / NHead;
+        kernels::register_linear(head_size, head_size, &linear<head_size, head_size>);
+        kernels::register_linear(NEmbd, NEmbd, &linear<NEmbd, NEmbd>);
+        kernels::register_linear(NEmbd, 4 * NEmbd, &linear<NEmbd, 4 * NEmbd>);
+        kernels::register_linear(4 * NEmbd, NEmbd, &linear<4 * NEmbd, NEmbd>);
+        kernels::register_layernorm(NEmbd, &layernorm<NEmbd>);
+        kernels::register_head(head_size, &head<head_size>);
+        kernels::register_feedforward(NEmbd, &feedforward<NEmbd>);
+    }
+}
+
+#endif // FIXEDKERNELS_HPP
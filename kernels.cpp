@@ -0,0 +1,102 @@
+#include "./kernels.hpp"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <utility>
+#include "./fixedkernels.hpp"
+
+using namespace std;
+
+namespace
+{
+    struct Registry
+    {
+        mutex lock;
+        map<pair<int, int>, LinearKernel> linear;
+        map<int, LayerNormKernel> layernorm;
+        map<int, HeadKernel> head;
+        map<int, FeedForwardKernel> feedforward;
+    };
+
+    atomic<bool> specialized_enabled{true};
+
+    Registry &registry()
+    {
+        static Registry r;
+        return r;
+    }
+
+    // Production configuration from util.cpp: n_embd 384, n_head 6 (head_size 64)
+    void register_builtin()
+    {
+        static bool registered = (fixedshape::register_model<384, 6>(), true);
+        (void)registered;
+    }
+
+    template <typename Map, typename Key>
+    typename Map::mapped_type find(Map &m, const Key &key)
+    {
+        register_builtin();
+        Registry &r = registry();
+        lock_guard<mutex> guard(r.lock);
+        auto it = m.find(key);
+        return it == m.end() ? nullptr : it->second;
+    }
+}
+
+namespace kernels
+{
+    void register_linear(int in_features, int out_features, LinearKernel kernel)
+    {
+        lock_guard<mutex> guard(registry().lock);
+        registry().linear[{in_features, out_features}] = kernel;
+    }
+
+    void register_layernorm(int n_embd, LayerNormKernel kernel)
+    {
+        lock_guard<mutex> guard(registry().lock);
+        registry().layernorm[n_embd] = kernel;
+    }
+
+    void register_head(int head_size, HeadKernel kernel)
+    {
+        lock_guard<mutex> guard(registry().lock);
+        registry().head[head_size] = kernel;
+    }
+
+    void register_feedforward(int n_embd, FeedForwardKernel kernel)
+    {
+        lock_guard<mutex> guard(registry().lock);
+        registry().feedforward[n_embd] = kernel;
+    }
+
+    LinearKernel find_linear(int in_features, int out_features)
+    {
+        return find(registry().linear, make_pair(in_features, out_features));
+    }
+
+    LayerNormKernel find_layernorm(int n_embd)
+    {
+        return find(registry().layernorm, n_embd);
+    }
+
+    HeadKernel find_head(int head_size)
+    {
+        return find(registry().head, head_size);
+    }
+
+    FeedForwardKernel find_feedforward(int n_embd)
+    {
+        return find(registry().feedforward, n_embd);
+    }
+
+    bool enabled()
+    {
+        return specialized_enabled.load(memory_order_relaxed);
+    }
+
+    void set_enabled(bool on)
+    {
+        specialized_enabled.store(on, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+using namespace std;
+
+// Registry of shape-specialized forward kernels (see fixedkernels.hpp).
+//
+// Layers look up a kernel for their shape when they are constructed and
+// call it instead of the runtime-sized loops when one is registered and
+// specialized kernels are enabled. All pointers are row-major parameter
+// data; x and y are single input/output vectors.
+//
+// The production shapes from util.cpp (n_embd 384, n_head 6) are built in.
+// Register other configurations with fixedshape::register_model<N_EMBD, N_HEAD>()
+// before constructing the layers that should use them.
+
+using LinearKernel = void (*)(const double *w, const double *b, const double *x, double *y);
+using LayerNormKernel = void (*)(const double *x, const double *gamma, const double *beta, double *y);
+using HeadKernel = void (*)(const double *wk, const double *bk, const double *wq, const double *bq,
+                            const double *wv, const double *bv, const double *x, double *y);
+using FeedForwardKernel = void (*)(const double *w1, const double *b1, const double *w2, const double *b2,
+                                   const double *x, double *y);
+
+namespace kernels
+{
+    void register_linear(int in_features, int out_features, LinearKernel kernel);
+    void register_layernorm(int n_embd, LayerNormKernel kernel);
+    void register_head(int head_size, HeadKernel kernel);
+    void register_feedforward(int n_embd, FeedForwardKernel kernel);
+
+    // nullptr when no specialization matches
+    LinearKernel find_linear(int in_features, int out_features);
+    LayerNormKernel find_layernorm(int n_embd);
+    HeadKernel find_head(int head_size);
+    FeedForwardKernel find_feedforward(int n_embd);
+
+    // Global switch, e.g. to compare against the runtime-shaped loops
+    bool enabled();
+    void set_enabled(bool on);
+}
+
+#endif // KERNELS_HPP
@@ -5,11 +5,13 @@
 #include <string>
 #include <vector>
 #include "./multiheadedgpt.hpp"
+#include "./sharedweights.hpp"
+#include "./trace.hpp"
 #include "./util.hpp"
 
 using namespace std;
 
-int main()
+int main(int argc, char **argv)
 {
 
     auto start = chrono::high_resolution_clock::now();
@@ -29,7 +31,28 @@ int main()
 
     loadSentences(inputFilename);
     splitDataset(encoded_data, 0.5); // 10% training, 90% testing
-    GPTLanguageModel gpt(vocab_size, n_embd, block_size, n_layer, n_head);
+
+    // --plan <MiB>: largest batch_size whose weights and activations fit, without building the model
+    if (argc == 3 && string(argv[1]) == "--plan")
+    {
+        size_t budget = static_cast<size_t>(stod(argv[2]) * 1024 * 1024);
+        int max_batch = GPTLanguageModel::plan_max_batch(vocab_size, n_embd, block_size, n_layer, n_head, budget);
+        cout << "Largest batch_size for block_size " << block_size << " in " << argv[2] << " MiB: " << max_batch << endl;
+        return 0;
+    }
+
+    // --publish <name>: generate the weights once into shared memory for worker processes
+    // --attach <name>:  use weights published by another process instead of building them
+    if (argc == 3 && string(argv[1]) == "--publish")
+    {
+        SharedWeights shared = SharedWeights::create(argv[2], vocab_size, n_embd, block_size, n_layer, n_head);
+        cout << "Published " << shared.header().parameter_count << " parameters to /dev/shm/" << argv[2]
+             << (shared.huge_pages() ? " (huge pages advised)" : "") << endl;
+        return 0;
+    }
+    bool attach = argc == 3 && string(argv[1]) == "--attach";
+    SharedWeights shared = attach ? SharedWeights::attach(argv[2]) : SharedWeights();
+    GPTLanguageModel gpt = attach ? shared.model() : GPTLanguageModel(vocab_size, n_embd, block_size, n_layer, n_head);
 
     // Training Loop
     // Activate once backward function is implemented
@@ -69,9 +92,16 @@ int main()
         cout << decode(seq) << " " << endl;
     }
 
+    memory::print_report(cout, gpt.memory_report(batch_size, block_size));
+
     auto end = chrono::high_resolution_clock::now();
     chrono::duration<double> elapsed = end - start;
     cout << "Elapsed time: " << elapsed.count() << " seconds" << endl;
 
+#ifdef GPT_TRACE
+    trace::write_chrome_trace("./trace.json");
+    trace::print_summary(cout);
+#endif
+
     return 0;
 }
\ No newline at end of file
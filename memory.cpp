@@ -0,0 +1,200 @@
+#include "./memory.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <sys/resource.h>
+
+using namespace std;
+
+namespace
+{
+    atomic<size_t> live_heap{0};
+    atomic<size_t> peak_heap{0};
+
+    double mib(size_t bytes)
+    {
+        return bytes / (1024.0 * 1024.0);
+    }
+}
+
+#ifdef GPT_TRACK_ALLOC
+
+// Every allocation carries a 16-byte header holding its size so the
+// unsized operator delete can decrement the live count.
+namespace
+{
+    const size_t header_size = 16;
+
+    void *tracked_alloc(size_t n)
+    {
+        void *raw = malloc(n + header_size);
+        if (raw == nullptr)
+        {
+            return nullptr;
+        }
+        *static_cast<size_t *>(raw) = n;
+        size_t live = live_heap.fetch_add(n, memory_order_relaxed) + n;
+        size_t peak = peak_heap.load(memory_order_relaxed);
+        while (live > peak && !peak_heap.compare_exchange_weak(peak, live, memory_order_relaxed))
+        {
+        }
+        return static_cast<char *>(raw) + header_size;
+    }
+
+    void tracked_free(void *p)
+    {
+        if (p == nullptr)
+        {
+            return;
+        }
+        void *raw = static_cast<char *>(p) - header_size;
+        live_heap.fetch_sub(*static_cast<size_t *>(raw), memory_order_relaxed);
+        free(raw);
+    }
+}
+
+void *operator new(size_t n)
+{
+    void *p = tracked_alloc(n);
+    if (p == nullptr)
+    {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t n) { return operator new(n); }
+void *operator new(size_t n, const nothrow_t &) noexcept { return tracked_alloc(n); }
+void *operator new[](size_t n, const nothrow_t &) noexcept { return tracked_alloc(n); }
+void operator delete(void *p) noexcept { tracked_free(p); }
+void operator delete[](void *p) noexcept { tracked_free(p); }
+void operator delete(void *p, size_t) noexcept { tracked_free(p); }
+void operator delete[](void *p, size_t) noexcept { tracked_free(p); }
+void operator delete(void *p, const nothrow_t &) noexcept { tracked_free(p); }
+void operator delete[](void *p, const nothrow_t &) noexcept { tracked_free(p); }
+
+#endif // GPT_TRACK_ALLOC
+
+namespace memory
+{
+    size_t allocation_bytes(size_t n)
+    {
+        if (n == 0)
+        {
+            return 0;
+        }
+        size_t chunk = (n + sizeof(size_t) + 15) & ~static_cast<size_t>(15);
+        return chunk < 32 ? 32 : chunk;
+    }
+
+    size_t vector_bytes(size_t n)
+    {
+        return sizeof(vector<double>) + allocation_bytes(n * sizeof(double));
+    }
+
+    size_t matrix_bytes(size_t rows, size_t cols)
+    {
+        return sizeof(vector<vector<double>>) + allocation_bytes(rows * sizeof(vector<double>)) +
+               rows * allocation_bytes(cols * sizeof(double));
+    }
+
+    size_t tensor3_bytes(size_t batches, size_t rows, size_t cols)
+    {
+        size_t inner = matrix_bytes(rows, cols) - sizeof(vector<vector<double>>);
+        return sizeof(vector<vector<vector<double>>>) + allocation_bytes(batches * sizeof(vector<vector<double>>)) +
+               batches * inner;
+    }
+
+    size_t parameter_bytes(size_t n)
+    {
+        return sizeof(Parameter) + allocation_bytes(n * sizeof(double));
+    }
+
+    ModuleMemory module(const string &name, const Parameter &p)
+    {
+        size_t payload = p.size() * sizeof(double);
+        if (!p.owned())
+        {
+            return {name, p.size(), payload, sizeof(Parameter), payload};
+        }
+        size_t total = sizeof(Parameter) + allocation_bytes(p.capacity() * sizeof(double));
+        return {name, p.size(), payload, total - payload, 0};
+    }
+
+    ModuleMemory combine(const string &name, const vector<ModuleMemory> &parts)
+    {
+        ModuleMemory out = {name, 0, 0, 0, 0};
+        for (const auto &part : parts)
+        {
+            out.parameters += part.parameters;
+            out.payload_bytes += part.payload_bytes;
+            out.overhead_bytes += part.overhead_bytes;
+            out.shared_bytes += part.shared_bytes;
+        }
+        return out;
+    }
+
+    bool tracking_enabled()
+    {
+#ifdef GPT_TRACK_ALLOC
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    size_t live_bytes()
+    {
+        return live_heap.load(memory_order_relaxed);
+    }
+
+    size_t peak_bytes()
+    {
+        return peak_heap.load(memory_order_relaxed);
+    }
+
+    void reset_peak()
+    {
+        peak_heap.store(live_heap.load(memory_order_relaxed), memory_order_relaxed);
+    }
+
+    size_t peak_rss_bytes()
+    {
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0;
+        }
+        // ru_maxrss is reported in kilobytes on Linux
+        return static_cast<size_t>(usage.ru_maxrss) * 1024;
+    }
+
+    void print_report(ostream &out, const MemoryReport &report)
+    {
+        ios saved(nullptr);
+        saved.copyfmt(out);
+        out << fixed << setprecision(2);
+        out << left << setw(28) << "module" << right << setw(14) << "parameters" << setw(12) << "MiB"
+            << setw(14) << "overhead MiB" << setw(12) << "shared MiB" << endl;
+        for (const auto &m : report.modules)
+        {
+            out << left << setw(28) << m.name << right << setw(14) << m.parameters << setw(12) << mib(m.payload_bytes)
+                << setw(14) << mib(m.overhead_bytes) << setw(12) << mib(m.shared_bytes) << endl;
+        }
+        out << "Parameters: " << mib(report.parameter_bytes) << " MiB (" << mib(report.shared_bytes)
+            << " MiB shared) + " << mib(report.overhead_bytes) << " MiB storage overhead" << endl;
+        out << "Activations for B=" << report.batch_size << ", T=" << report.block_size << ": "
+            << mib(report.activations.total) << " MiB (residual " << mib(report.activations.residual)
+            << ", logits " << mib(report.activations.logits) << ", loss " << mib(report.activations.loss)
+            << ", embeddings " << mib(report.activations.embeddings) << ")" << endl;
+        out << "K/V cache (not allocated): " << mib(report.kv_cache_bytes) << " MiB" << endl;
+        if (tracking_enabled())
+        {
+            out << "Heap: " << mib(report.live_heap_bytes) << " MiB live, " << mib(report.peak_heap_bytes)
+                << " MiB peak" << endl;
+        }
+        out << "Peak RSS: " << mib(report.peak_rss_bytes) << " MiB" << endl;
+        out.copyfmt(saved);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "./parameter.hpp"
+
+using namespace std;
+
+// Memory accounting for the model.
+//
+// Parameter and activation sizes are computed from the shapes and storage
+// capacities, including per-allocation overhead. Parameters are contiguous
+// (parameter.hpp); activations are still nested vectors, and their cost
+// includes one allocation per row. Live/peak heap figures come from a tracking
+// operator new/delete that is compiled in with -DGPT_TRACK_ALLOC (CMake
+// option GPT_ENABLE_ALLOC_TRACKING); without it they read as zero.
+
+struct ModuleMemory
+{
+    string name;
+    size_t parameters;     // number of doubles
+    size_t payload_bytes;  // parameters * sizeof(double)
+    size_t overhead_bytes; // object headers, malloc chunk headers and slack
+    size_t shared_bytes;   // part of payload_bytes mapped from a shared segment
+};
+
+struct ActivationMemory
+{
+    size_t embeddings;     // tok_emb, pos_emb
+    size_t residual;       // x and the copy each Block/LayerNorm returns
+    size_t logits;         // lm_head output
+    size_t loss;           // flattened logits and targets, only with targets
+    size_t total;
+};
+
+struct MemoryReport
+{
+    vector<ModuleMemory> modules;
+    size_t parameter_bytes;
+    size_t overhead_bytes;
+    size_t shared_bytes;
+    int batch_size;
+    int block_size;
+    ActivationMemory activations;
+    size_t kv_cache_bytes;   // what a per-layer K/V cache would hold; not allocated
+    size_t live_heap_bytes;  // tracking allocator, 0 when disabled
+    size_t peak_heap_bytes;
+    size_t peak_rss_bytes;
+};
+
+namespace memory
+{
+    // Bytes malloc hands out for a request of n bytes (glibc: 16-byte
+    // granularity, 8-byte header, 32-byte minimum)
+    size_t allocation_bytes(size_t n);
+
+    // Heap plus inline footprint of vector<double>(n), of a rows x cols
+    // vector<vector<double>>, of a batches x rows x cols nested vector and
+    // of an owning Parameter holding n doubles
+    size_t vector_bytes(size_t n);
+    size_t matrix_bytes(size_t rows, size_t cols);
+    size_t tensor3_bytes(size_t batches, size_t rows, size_t cols);
+    size_t parameter_bytes(size_t n);
+
+    ModuleMemory module(const string &name, const Parameter &p);
+    ModuleMemory combine(const string &name, const vector<ModuleMemory> &parts);
+
+    bool tracking_enabled();
+    size_t live_bytes();
+    size_t peak_bytes();
+    void reset_peak();
+
+    size_t peak_rss_bytes();
+
+    void print_report(ostream &out, const MemoryReport &report);
+}
+
+#endif // MEMORY_HPP
@@ -2,22 +2,37 @@
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include "./trace.hpp"
 
 using namespace std;
 
-GPTLanguageModel::GPTLanguageModel(int vocab_size, int n_embd, int block_size, int n_layer, int n_head)
+GPTLanguageModel::GPTLanguageModel(int vocab_size, int n_embd, int block_size, int n_layer, int n_head, uint64_t seed)
+    : GPTLanguageModel(vocab_size, n_embd, block_size, n_layer, n_head, WeightInit(seed))
+{
+}
+
+GPTLanguageModel::GPTLanguageModel(int vocab_size, int n_embd, int block_size, int n_layer, int n_head, WeightInit &&init)
+    : GPTLanguageModel(vocab_size, n_embd, block_size, n_layer, n_head, init)
+{
+}
+
+GPTLanguageModel::GPTLanguageModel(int vocab_size, int n_embd, int block_size, int n_layer, int n_head, WeightInit &init)
     : vocab_size(vocab_size), n_embd(n_embd), block_size(block_size),
-      token_embedding_table(vocab_size, vector<double>(n_embd)),
-      position_embedding_table(block_size, vector<double>(n_embd)),
-      blocks(vector<Block>(n_layer, Block(n_embd, n_head))),
-      ln_f(LayerNorm(n_embd)),
-      lm_head(Linear(n_embd, vocab_size))
+      ln_f(LayerNorm(n_embd, init)),
+      lm_head(Linear(n_embd, vocab_size, init))
 {
-    initialize_weights();
+    // Construct each layer separately so every Block gets its own weights
+    blocks.reserve(n_layer);
+    for (int i = 0; i < n_layer; ++i)
+    {
+        blocks.push_back(Block(n_embd, n_head, init));
+    }
+    initialize_weights(init);
 }
 
 pair<vector<vector<vector<double>>>, double> GPTLanguageModel::forward(const vector<vector<int>> &idx, const vector<vector<int>> *targets)
 {
+    TRACE_SCOPE("GPTLanguageModel::forward", 0.0, 0.0);
     int B = idx.size();
     int T = idx[0].size();
 
@@ -27,14 +42,14 @@ pair<vector<vector<vector<double>>>, double> GPTLanguageModel::forward(const vec
     {
         for (int j = 0; j < T; ++j)
         {
-            tok_emb[i][j] = token_embedding_table[0][j];
+            tok_emb[i][j] = token_embedding_table.row(0)[j];
         }
     }
 
     vector<vector<double>> pos_emb(T, vector<double>(n_embd));
     for (int i = 0; i < T; ++i)
     {
-        pos_emb[i] = position_embedding_table[i];
+        pos_emb[i].assign(position_embedding_table.row(i), position_embedding_table.row(i) + n_embd);
     }
 
     vector<vector<vector<double>>> x(B, vector<vector<double>>(T, vector<double>(n_embd)));
@@ -52,7 +67,11 @@ pair<vector<vector<vector<double>>>, double> GPTLanguageModel::forward(const vec
     }
 
     x = ln_f.forward(x);
-    vector<vector<vector<double>>> logits = lm_head.forward(x);
+    vector<vector<vector<double>>> logits;
+    {
+        TRACE_SCOPE("GPTLanguageModel::lm_head", static_cast<double>(B) * T * lm_head.flops(), static_cast<double>(B) * T * lm_head.bytes());
+        logits = lm_head.forward(x);
+    }
 
     double loss = 0.0;
     if (targets != nullptr)
@@ -81,66 +100,263 @@ pair<vector<vector<vector<double>>>, double> GPTLanguageModel::forward(const vec
 
 vector<vector<int>> GPTLanguageModel::generate(vector<vector<int>> &idx, int max_new_tokens)
 {
-    for (int i = 0; i < max_new_tokens; ++i)
+    TRACE_SCOPE("GPTLanguageModel::generate", 0.0, 0.0);
+    GenerateOptions options;
+    options.max_new_tokens = max_new_tokens;
+    for (const TokenEvent &event : stream(idx, options))
     {
-        vector<vector<int>> idx_cond;
-        for (auto &seq : idx)
+        idx[event.sequence].push_back(event.token);
+        if (event.sequence == 0)
         {
-            idx_cond.push_back(vector<int>(seq.end() - block_size, seq.end()));
+            cout << "Generated token... ";
         }
-        auto [logits, loss] = forward(idx_cond);
-        vector<vector<double>> cropped_logits = vector<vector<double>>(logits.size(), vector<double>(logits[0].size()));
-        for (int j = 0; j < logits.size(); ++j)
+    }
+    cout << endl;
+    return idx;
+}
+
+int GPTLanguageModel::prune(int n, int m, const vector<string> &targets)
+{
+    vector<Linear *> matched;
+    LinearVisitor visit = [&](const string &name, Linear &linear)
+    {
+        for (const auto &target : targets)
         {
-            cropped_logits[j] = logits[0][j];
+            if (name.find(target) != string::npos)
+            {
+                matched.push_back(&linear);
+                return;
+            }
         }
-        vector<vector<double>> probs = softmax(cropped_logits);
-        vector<vector<int>> idx_next = multinomial(probs, 1);
-        for (int j = 0; j < idx.size(); ++j)
+    };
+    for_each_linear(visit);
+
+    // Validate every layer first so a bad n:m leaves the model untouched
+    for (Linear *linear : matched)
+    {
+        if (!linear->sparse())
         {
-            idx[j].push_back(idx_next[j][0]);
+            SparseWeights::check_pattern(n, m, linear->in_features());
         }
+    }
+    for (Linear *linear : matched)
+    {
+        linear->prune(n, m);
+    }
+    return static_cast<int>(matched.size());
+}
+
+void GPTLanguageModel::for_each_linear(const LinearVisitor &visit)
+{
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        blocks[i].for_each_linear("blocks[" + to_string(i) + "]", visit);
+    }
+    visit("lm_head", lm_head);
+}
 
-        // Print attention vectors 
-        double total = 0.0;
-        for (const auto &attention_vector : logits)
+TokenStream GPTLanguageModel::stream(vector<vector<int>> idx, GenerateOptions options)
+{
+    vector<bool> active(idx.size(), true);
+    for (int step = 0; step < options.max_new_tokens && !options.cancel.stop_requested(); ++step)
+    {
+        vector<TokenEvent> events = decode_step(idx, active, step, options.stop_tokens);
+        if (events.empty())
         {
-            for (const auto &val : attention_vector[0])
-            {
-                total += val;
-            }
+            break;
+        }
+        for (const TokenEvent &event : events)
+        {
+            co_yield event;
         }
+    }
+}
 
-        cout << "Generated token... " ;
+StreamTask GPTLanguageModel::stream_async(vector<vector<int>> idx, GenerateOptions options, Executor &executor,
+                                          function<void(const TokenEvent &)> on_token)
+{
+    vector<bool> active(idx.size(), true);
+    for (int step = 0; step < options.max_new_tokens; ++step)
+    {
+        co_await executor.schedule();
+        if (options.cancel.stop_requested())
+        {
+            break;
+        }
+        vector<TokenEvent> events = decode_step(idx, active, step, options.stop_tokens);
+        if (events.empty())
+        {
+            break;
+        }
+        for (const TokenEvent &event : events)
+        {
+            on_token(event);
+        }
     }
-    cout << endl;
-    return idx;
 }
 
-void GPTLanguageModel::initialize_weights()
+vector<TokenEvent> GPTLanguageModel::decode_step(vector<vector<int>> &idx, vector<bool> &active, int step,
+                                                 const vector<int> &stop_tokens)
 {
-    random_device rd;
-    mt19937 gen(42);
-    normal_distribution<> d(0.0, 0.02);
-    for (auto &row : token_embedding_table)
+    TRACE_SCOPE("GPTLanguageModel::decode_step", 0.0, 0.0);
+    // Finished sequences are left out of the batch entirely
+    vector<int> rows;
+    vector<vector<int>> idx_cond;
+    for (size_t i = 0; i < idx.size(); ++i)
+    {
+        if (!active[i])
+        {
+            continue;
+        }
+        // Last block_size tokens, left-padded with token 0 while the sequence is shorter
+        vector<int> context(block_size, 0);
+        size_t n = min(idx[i].size(), static_cast<size_t>(block_size));
+        copy(idx[i].end() - n, idx[i].end(), context.end() - n);
+        rows.push_back(i);
+        idx_cond.push_back(move(context));
+    }
+    if (rows.empty())
+    {
+        return {};
+    }
+
+    auto [logits, loss] = forward(idx_cond);
+    vector<vector<double>> last_logits(rows.size());
+    for (size_t j = 0; j < rows.size(); ++j)
     {
-        std::generate(row.begin(), row.end(), [&]()
-                 { return d(gen); });
+        last_logits[j] = logits[j].back();
     }
-    for (auto &row : position_embedding_table)
+    vector<vector<double>> probs = softmax(last_logits);
+    vector<vector<int>> idx_next = multinomial(probs, 1);
+
+    vector<TokenEvent> events;
+    for (size_t j = 0; j < rows.size(); ++j)
     {
-        std::generate(row.begin(), row.end(), [&]()
-                 { return d(gen); });
+        int token = idx_next[j][0];
+        idx[rows[j]].push_back(token);
+        events.push_back({rows[j], token, step});
+        if (find(stop_tokens.begin(), stop_tokens.end(), token) != stop_tokens.end())
+        {
+            active[rows[j]] = false;
+        }
     }
+    return events;
+}
 
-    cout << "Initialized weights" << endl;
-    cout << "Token embedding table: " << token_embedding_table.size() << " x " << token_embedding_table[0].size() << endl;
-    cout << "Position embedding table: " << position_embedding_table.size() << " x " << position_embedding_table[0].size() << endl;
+void GPTLanguageModel::initialize_weights(WeightInit &init)
+{
+    token_embedding_table = init.normal(vocab_size, n_embd, 0.0, 0.02);
+    position_embedding_table = init.normal(block_size, n_embd, 0.0, 0.02);
+
+    cout << "Initialized weights (seed " << init.seed() << ")" << endl;
+    cout << "Token embedding table: " << token_embedding_table.rows() << " x " << token_embedding_table.cols() << endl;
+    cout << "Position embedding table: " << position_embedding_table.rows() << " x " << position_embedding_table.cols() << endl;
     cout << "Blocks: " << blocks.size() << endl;
 }
 
+MemoryReport GPTLanguageModel::memory_report(int batch_size, int block_size, bool with_targets) const
+{
+    MemoryReport report = {};
+    report.modules.push_back(memory::module("token_embedding_table", token_embedding_table));
+    report.modules.push_back(memory::module("position_embedding_table", position_embedding_table));
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        vector<ModuleMemory> parts = blocks[i].memory_usage("blocks[" + to_string(i) + "]");
+        report.modules.insert(report.modules.end(), parts.begin(), parts.end());
+    }
+    report.modules.push_back(ln_f.memory_usage("ln_f"));
+    report.modules.push_back(lm_head.memory_usage("lm_head"));
+    for (const auto &m : report.modules)
+    {
+        report.parameter_bytes += m.payload_bytes;
+        report.overhead_bytes += m.overhead_bytes;
+        report.shared_bytes += m.shared_bytes;
+    }
+
+    report.batch_size = batch_size;
+    report.block_size = block_size;
+    report.activations = project_activations(vocab_size, n_embd, batch_size, block_size, with_targets);
+    report.kv_cache_bytes = 2 * blocks.size() * sizeof(double) * batch_size * block_size * n_embd;
+    report.live_heap_bytes = memory::live_bytes();
+    report.peak_heap_bytes = memory::peak_bytes();
+    report.peak_rss_bytes = memory::peak_rss_bytes();
+    return report;
+}
+
+size_t GPTLanguageModel::project_parameter_bytes(int vocab_size, int n_embd, int block_size, int n_layer, int n_head)
+{
+    auto linear = [](size_t in, size_t out)
+    { return memory::parameter_bytes(out * in) + memory::parameter_bytes(out); };
+    auto layernorm = [](size_t n)
+    { return 2 * memory::parameter_bytes(n); };
+
+    size_t head_size = n_embd / n_head;
+    size_t block = n_head * 3 * linear(head_size, head_size) + linear(n_embd, n_embd) +
+                   linear(n_embd, 4 * n_embd) + linear(4 * n_embd, n_embd) + 2 * layernorm(n_embd);
+    return memory::parameter_bytes(vocab_size * n_embd) + memory::parameter_bytes(block_size * n_embd) +
+           n_layer * block + layernorm(n_embd) + linear(n_embd, vocab_size);
+}
+
+ActivationMemory GPTLanguageModel::project_activations(int vocab_size, int n_embd, int batch_size, int block_size, bool with_targets)
+{
+    size_t B = batch_size, T = block_size;
+    ActivationMemory a = {};
+    a.embeddings = memory::matrix_bytes(B, T) + memory::matrix_bytes(T, n_embd);
+    size_t x = memory::tensor3_bytes(B, T, n_embd);
+    a.logits = memory::tensor3_bytes(B, T, vocab_size);
+    if (with_targets)
+    {
+        // flat_logits and flat_targets grow by push_back: capacity rounds up to a
+        // power of two, and the last reallocation briefly holds the old half too
+        size_t n = B * T * vocab_size;
+        size_t capacity = 1;
+        while (capacity < n)
+        {
+            capacity <<= 1;
+        }
+        a.loss = 2 * memory::vector_bytes(capacity) + memory::allocation_bytes(capacity / 2 * sizeof(double));
+    }
+    // Each Block and ln_f returns a copy of x; lm_head holds x next to the logits
+    a.residual = 2 * x;
+    a.total = a.embeddings + max(2 * x, x + a.logits + a.loss);
+    return a;
+}
+
+int GPTLanguageModel::plan_max_batch(int vocab_size, int n_embd, int block_size, int n_layer, int n_head,
+                                     size_t budget_bytes, bool with_targets)
+{
+    size_t params = project_parameter_bytes(vocab_size, n_embd, block_size, n_layer, n_head);
+    auto fits = [&](int B)
+    { return params + project_activations(vocab_size, n_embd, B, block_size, with_targets).total <= budget_bytes; };
+
+    if (!fits(1))
+    {
+        return 0;
+    }
+    int lo = 1, hi = 2;
+    while (hi < (1 << 24) && fits(hi))
+    {
+        lo = hi;
+        hi *= 2;
+    }
+    while (hi - lo > 1)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (fits(mid))
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
 double GPTLanguageModel::cross_entropy(const vector<double> &logits, const vector<double> &targets)
 {
+    TRACE_SCOPE("GPTLanguageModel::cross_entropy", 6.0 * logits.size(), sizeof(double) * 2.0 * logits.size());
     int count = logits.size();
     double loss = 0.0;
     for (int i = 0; i < count; ++i) {
@@ -154,6 +370,7 @@ double GPTLanguageModel::cross_entropy(const vector<double> &logits, const vecto
 
 vector<vector<double>> GPTLanguageModel::softmax(const vector<vector<double>> &logits)
 {
+    TRACE_SCOPE("GPTLanguageModel::softmax", 4.0 * logits.size() * logits[0].size(), sizeof(double) * 2.0 * logits.size() * logits[0].size());
     vector<vector<double>> probs(logits.size(), vector<double>(logits[0].size(), 0.0));
     for (int i = 0; i < logits.size(); ++i)
     {
@@ -169,11 +386,12 @@ vector<vector<double>> GPTLanguageModel::softmax(const vector<vector<double>> &l
             probs[i][j] /= sum;
         }
     }
-    return logits;
+    return probs;
 }
 
 vector<vector<int>> GPTLanguageModel::multinomial(const vector<vector<double>> &probs, int num_samples)
 {
+    TRACE_SCOPE("GPTLanguageModel::multinomial", 2.0 * probs.size() * probs[0].size(), sizeof(double) * probs.size() * probs[0].size());
     vector<vector<int>> rslt(probs.size(), vector<int>(num_samples, 0));
     for (int i = 0; i < probs.size(); ++i)
     {
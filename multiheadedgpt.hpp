@@ -1,34 +1,79 @@
 #ifndef GPTLANGUAGEMODEL_HPP
 #define GPTLANGUAGEMODEL_HPP
 
+#include <functional>
 #include <vector>
 #include <random>
 #include "./attentionmechanism.hpp"
+#include "./memory.hpp"
+#include "./tokenstream.hpp"
 
 using namespace std;
 
 class GPTLanguageModel
 {
 public:
-    GPTLanguageModel(int vocab_size, int n_embd, int block_size, int n_layer, int n_head);
+    // Every weight is drawn from a sub-stream of `seed`; the same seed and shapes give the same model
+    GPTLanguageModel(int vocab_size, int n_embd, int block_size, int n_layer, int n_head, uint64_t seed = 1337);
+
+    // Takes every parameter from `init` in construction order; see SharedWeights for a non-allocating source
+    GPTLanguageModel(int vocab_size, int n_embd, int block_size, int n_layer, int n_head, WeightInit &init);
 
     pair<vector<vector<vector<double>>>, double> forward(const vector<vector<int>> &idx, const vector<vector<int>> *targets = nullptr);
 
     vector<vector<int>> generate(vector<vector<int>> &idx, int max_new_tokens);
 
+    // Offline magnitude pruning to n:m structured sparsity (see sparse.hpp) of
+    // every Linear whose for_each_linear() name contains one of `targets`, e.g.
+    // "ffwd", "sa.heads", "lm_head". Returns the number of layers pruned.
+    // Throws invalid_argument, pruning nothing, if n:m does not fit one of them.
+    int prune(int n, int m, const vector<string> &targets);
+
+    // Every Linear of the model, named like "blocks[0].ffwd.linear1" and "lm_head"
+    void for_each_linear(const LinearVisitor &visit);
+
+    // Token-by-token generation (see tokenstream.hpp). Prompts may differ in
+    // length; each step sees the last block_size tokens of every sequence,
+    // left-padded with token 0. The model must outlive the stream; concurrent
+    // streams on one model are fine since forward() keeps no per-call state.
+    TokenStream stream(vector<vector<int>> idx, GenerateOptions options);
+
+    // Runs every decode step on `executor` and calls on_token from its
+    // threads, rescheduling between steps so streams share the executor
+    StreamTask stream_async(vector<vector<int>> idx, GenerateOptions options, Executor &executor,
+                            function<void(const TokenEvent &)> on_token);
+
+    // Parameter bytes per module, projected activations for one forward of
+    // (batch_size, block_size), and the current heap and RSS figures
+    MemoryReport memory_report(int batch_size, int block_size, bool with_targets = true) const;
+
+    // Sizing without building a model: parameter storage for a configuration,
+    // activations for one forward, and the largest batch whose parameters
+    // plus activations fit in budget_bytes (0 if none does)
+    static size_t project_parameter_bytes(int vocab_size, int n_embd, int block_size, int n_layer, int n_head);
+    static ActivationMemory project_activations(int vocab_size, int n_embd, int batch_size, int block_size, bool with_targets);
+    static int plan_max_batch(int vocab_size, int n_embd, int block_size, int n_layer, int n_head,
+                              size_t budget_bytes, bool with_targets = true);
+
     //void backwards(const vector<double>& inputs, const vector<double>& targets, double learningRate);
 
 private:
     int vocab_size;
     int n_embd;
     int block_size;
-    vector<vector<double>> token_embedding_table;
-    vector<vector<double>> position_embedding_table;
+    Parameter token_embedding_table;
+    Parameter position_embedding_table;
     vector<Block> blocks;
     LayerNorm ln_f;
     Linear lm_head;
 
-    void initialize_weights();
+    GPTLanguageModel(int vocab_size, int n_embd, int block_size, int n_layer, int n_head, WeightInit &&init);
+
+    void initialize_weights(WeightInit &init);
+
+    // One forward over the active sequences; appends a sampled token to each
+    // and deactivates those that produced a stop token
+    vector<TokenEvent> decode_step(vector<vector<int>> &idx, vector<bool> &active, int step, const vector<int> &stop_tokens);
 
     //double error(double x);
     
@@ -0,0 +1,61 @@
+#include "./parameter.hpp"
+#include <utility>
+
+using namespace std;
+
+Parameter::Parameter() : ptr(nullptr), n_rows(0), n_cols(0) {}
+
+Parameter::Parameter(size_t rows, size_t cols, double value)
+    : storage(rows * cols, value), ptr(storage.data()), n_rows(rows), n_cols(cols)
+{
+}
+
+Parameter Parameter::view(double *data, size_t rows, size_t cols)
+{
+    Parameter p;
+    p.ptr = data;
+    p.n_rows = rows;
+    p.n_cols = cols;
+    return p;
+}
+
+Parameter::Parameter(const Parameter &other)
+    : storage(other.storage), ptr(other.owned() ? storage.data() : other.ptr), n_rows(other.n_rows), n_cols(other.n_cols)
+{
+}
+
+// Moving a vector keeps its buffer, so ptr stays valid for owned storage too
+Parameter::Parameter(Parameter &&other) noexcept
+    : storage(move(other.storage)), ptr(other.ptr), n_rows(other.n_rows), n_cols(other.n_cols)
+{
+    other.ptr = nullptr;
+    other.n_rows = 0;
+    other.n_cols = 0;
+}
+
+Parameter &Parameter::operator=(const Parameter &other)
+{
+    if (this != &other)
+    {
+        storage = other.storage;
+        ptr = other.owned() ? storage.data() : other.ptr;
+        n_rows = other.n_rows;
+        n_cols = other.n_cols;
+    }
+    return *this;
+}
+
+Parameter &Parameter::operator=(Parameter &&other) noexcept
+{
+    if (this != &other)
+    {
+        storage = move(other.storage);
+        ptr = other.ptr;
+        n_rows = other.n_rows;
+        n_cols = other.n_cols;
+        other.ptr = nullptr;
+        other.n_rows = 0;
+        other.n_cols = 0;
+    }
+    return *this;
+}
@@ -0,0 +1,48 @@
+#ifndef PARAMETER_HPP
+#define PARAMETER_HPP
+
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// A rows x cols block of weights, stored contiguously in row-major order.
+//
+// A Parameter either owns its storage or is a view onto memory owned by
+// someone else (e.g. a shared-memory segment, see sharedweights.hpp).
+// Copying an owning Parameter copies the data; copying a view copies the
+// pointer only.
+
+class Parameter
+{
+public:
+    Parameter();
+    Parameter(size_t rows, size_t cols, double value = 0.0);
+    static Parameter view(double *data, size_t rows, size_t cols);
+
+    Parameter(const Parameter &other);
+    Parameter(Parameter &&other) noexcept;
+    Parameter &operator=(const Parameter &other);
+    Parameter &operator=(Parameter &&other) noexcept;
+
+    size_t rows() const { return n_rows; }
+    size_t cols() const { return n_cols; }
+    size_t size() const { return n_rows * n_cols; }
+    bool owned() const { return !storage.empty(); }
+    size_t capacity() const { return storage.capacity(); }
+
+    double *data() { return ptr; }
+    const double *data() const { return ptr; }
+    double *row(size_t r) { return ptr + r * n_cols; }
+    const double *row(size_t r) const { return ptr + r * n_cols; }
+    double &operator[](size_t i) { return ptr[i]; }
+    double operator[](size_t i) const { return ptr[i]; }
+
+private:
+    vector<double> storage;
+    double *ptr;
+    size_t n_rows;
+    size_t n_cols;
+};
+
+#endif // PARAMETER_HPP
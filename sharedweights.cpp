@@ -0,0 +1,283 @@
+#include "./sharedweights.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    const uint64_t shared_magic = 0x3153544847575047ull; // "GPWGHTS1"
+    const uint32_t shared_version = 1;
+
+    // Parameters start one page in, each aligned to a cache line
+    const size_t header_bytes = 4096;
+    const size_t parameter_alignment = 64;
+    const size_t huge_page_bytes = 2 * 1024 * 1024;
+
+    size_t round_up(size_t n, size_t to)
+    {
+        return (n + to - 1) / to * to;
+    }
+
+    string shm_name(const string &name)
+    {
+        return name.empty() || name[0] != '/' ? "/" + name : name;
+    }
+
+    runtime_error shm_error(const string &what, const string &name)
+    {
+        return runtime_error(what + " " + name + ": " + strerror(errno));
+    }
+
+    // Hands out parameters at consecutive offsets of a segment, in the order
+    // the model constructor requests them. Sub-streams are consumed exactly
+    // as WeightInit does, so a shared model equals a private one with the
+    // same seed.
+    class SegmentInit : public WeightInit
+    {
+    public:
+        enum Mode
+        {
+            Layout, // compute offsets only; payload is null
+            Write,  // generate values into the segment
+            View    // segment already holds the values
+        };
+
+        SegmentInit(uint64_t seed, char *payload, Mode mode) : WeightInit(seed), payload(payload), mode(mode) {}
+
+        Parameter normal(size_t rows, size_t cols, double mean, double stddev) override
+        {
+            uint64_t stream = next_stream();
+            double *p = place(rows * cols);
+            if (mode == Write)
+            {
+                fill(p, rows * cols, stream, mean, stddev);
+            }
+            return Parameter::view(p, rows, cols);
+        }
+
+        Parameter constant(size_t rows, size_t cols, double value) override
+        {
+            double *p = place(rows * cols);
+            if (mode == Write)
+            {
+                std::fill(p, p + rows * cols, value);
+            }
+            return Parameter::view(p, rows, cols);
+        }
+
+        size_t used_bytes() const { return offset; }
+        size_t parameter_count() const { return count; }
+
+    private:
+        double *place(size_t n)
+        {
+            offset = round_up(offset, parameter_alignment);
+            double *p = payload == nullptr ? nullptr : reinterpret_cast<double *>(payload + offset);
+            offset += n * sizeof(double);
+            count += n;
+            return p;
+        }
+
+        char *payload;
+        Mode mode;
+        size_t offset = 0;
+        size_t count = 0;
+    };
+
+    bool advise_huge_pages(void *base, size_t length)
+    {
+#ifdef MADV_HUGEPAGE
+        return madvise(base, length, MADV_HUGEPAGE) == 0;
+#else
+        return false;
+#endif
+    }
+}
+
+SharedWeights::SharedWeights() : base(nullptr), length(0), hugepage_advised(false) {}
+
+SharedWeights::SharedWeights(void *base, size_t length, bool hugepage_advised)
+    : base(base), length(length), hugepage_advised(hugepage_advised)
+{
+}
+
+SharedWeights::~SharedWeights()
+{
+    if (base != nullptr)
+    {
+        munmap(base, length);
+    }
+}
+
+SharedWeights::SharedWeights(SharedWeights &&other) noexcept
+    : base(other.base), length(other.length), hugepage_advised(other.hugepage_advised)
+{
+    other.base = nullptr;
+    other.length = 0;
+}
+
+SharedWeights &SharedWeights::operator=(SharedWeights &&other) noexcept
+{
+    if (this != &other)
+    {
+        if (base != nullptr)
+        {
+            munmap(base, length);
+        }
+        base = other.base;
+        length = other.length;
+        hugepage_advised = other.hugepage_advised;
+        other.base = nullptr;
+        other.length = 0;
+    }
+    return *this;
+}
+
+SharedWeights SharedWeights::create(const string &name, int vocab_size, int n_embd, int block_size, int n_layer,
+                                    int n_head, uint64_t seed)
+{
+    // Dry run to size the segment; nothing is allocated or filled
+    SegmentInit layout(seed, nullptr, SegmentInit::Layout);
+    GPTLanguageModel probe(vocab_size, n_embd, block_size, n_layer, n_head, layout);
+    size_t length = round_up(header_bytes + layout.used_bytes(), huge_page_bytes);
+
+    // Workers still mapping an older segment keep it until they unmap
+    string path = shm_name(name);
+    shm_unlink(path.c_str());
+    int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        throw shm_error("shm_open", path);
+    }
+    if (ftruncate(fd, length) != 0)
+    {
+        runtime_error error = shm_error("ftruncate", path);
+        close(fd);
+        shm_unlink(path.c_str());
+        throw error;
+    }
+    void *base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        runtime_error error = shm_error("mmap", path);
+        close(fd);
+        shm_unlink(path.c_str());
+        throw error;
+    }
+    bool huge = advise_huge_pages(base, length);
+
+    // Never leave a half-written segment behind for attach() to find
+    try
+    {
+        SegmentInit writer(seed, static_cast<char *>(base) + header_bytes, SegmentInit::Write);
+        GPTLanguageModel generated(vocab_size, n_embd, block_size, n_layer, n_head, writer);
+
+        SharedModelHeader *header = static_cast<SharedModelHeader *>(base);
+        header->version = shared_version;
+        header->vocab_size = vocab_size;
+        header->n_embd = n_embd;
+        header->block_size = block_size;
+        header->n_layer = n_layer;
+        header->n_head = n_head;
+        header->seed = seed;
+        header->payload_bytes = writer.used_bytes();
+        header->parameter_count = writer.parameter_count();
+        // Publish the magic last so a concurrent attach never sees a partial segment
+        atomic_thread_fence(memory_order_release);
+        header->magic = shared_magic;
+
+        if (mprotect(base, length, PROT_READ) != 0)
+        {
+            throw shm_error("mprotect", path);
+        }
+        if (fchmod(fd, 0444) != 0)
+        {
+            throw shm_error("fchmod", path);
+        }
+    }
+    catch (...)
+    {
+        munmap(base, length);
+        close(fd);
+        shm_unlink(path.c_str());
+        throw;
+    }
+    close(fd);
+    return SharedWeights(base, length, huge);
+}
+
+SharedWeights SharedWeights::attach(const string &name)
+{
+    string path = shm_name(name);
+    int fd = shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        throw shm_error("shm_open", path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        runtime_error error = shm_error("fstat", path);
+        close(fd);
+        throw error;
+    }
+    size_t length = st.st_size;
+    if (length < header_bytes)
+    {
+        close(fd);
+        throw runtime_error(path + " is not a shared weight segment");
+    }
+    void *base = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        throw shm_error("mmap", path);
+    }
+
+    SharedWeights shared(base, length, advise_huge_pages(base, length));
+    const SharedModelHeader &h = shared.header();
+    if (h.magic != shared_magic || h.version != shared_version || header_bytes + h.payload_bytes > length)
+    {
+        throw runtime_error(path + " is not a complete version " + to_string(shared_version) + " weight segment");
+    }
+    return shared;
+}
+
+void SharedWeights::remove(const string &name)
+{
+    string path = shm_name(name);
+    if (shm_unlink(path.c_str()) != 0 && errno != ENOENT)
+    {
+        throw shm_error("shm_unlink", path);
+    }
+}
+
+const SharedModelHeader &SharedWeights::header() const
+{
+    return *static_cast<const SharedModelHeader *>(base);
+}
+
+GPTLanguageModel SharedWeights::model() const
+{
+    if (base == nullptr)
+    {
+        throw runtime_error("SharedWeights::model called without an attached segment");
+    }
+    const SharedModelHeader &h = header();
+    // The mapping is read-only; views are never written through
+    SegmentInit viewer(h.seed, static_cast<char *>(base) + header_bytes, SegmentInit::View);
+    GPTLanguageModel model(h.vocab_size, h.n_embd, h.block_size, h.n_layer, h.n_head, viewer);
+    if (viewer.used_bytes() != h.payload_bytes)
+    {
+        throw runtime_error("shared weight segment does not match its header's model configuration");
+    }
+    return model;
+}
@@ -0,0 +1,72 @@
+#ifndef SHAREDWEIGHTS_HPP
+#define SHAREDWEIGHTS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "./multiheadedgpt.hpp"
+
+using namespace std;
+
+// Model weights in a named POSIX shared-memory segment.
+//
+// A loader process calls create(), which generates every parameter directly
+// into /dev/shm/<name> and then seals the segment read-only. Worker processes
+// call attach() and model(), which builds a GPTLanguageModel whose
+// parameters are views onto the mapping. No weights are copied, so host
+// memory for weights is paid once however many workers attach.
+//
+// The segment is rounded up to 2 MiB and advised for transparent huge pages
+// (shmem_enabled=advise or always); if the kernel declines, regular pages
+// are used.
+//
+// Models returned by model() must not outlive the SharedWeights they came
+// from. The segment stays in /dev/shm after all processes exit until
+// remove() is called.
+
+struct SharedModelHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    int32_t vocab_size;
+    int32_t n_embd;
+    int32_t block_size;
+    int32_t n_layer;
+    int32_t n_head;
+    uint64_t seed;
+    uint64_t payload_bytes;
+    uint64_t parameter_count;
+};
+
+class SharedWeights
+{
+public:
+    SharedWeights();
+    ~SharedWeights();
+    SharedWeights(SharedWeights &&other) noexcept;
+    SharedWeights &operator=(SharedWeights &&other) noexcept;
+    SharedWeights(const SharedWeights &) = delete;
+    SharedWeights &operator=(const SharedWeights &) = delete;
+
+    // Replaces any existing segment of the same name. Throws runtime_error on failure.
+    static SharedWeights create(const string &name, int vocab_size, int n_embd, int block_size, int n_layer,
+                                int n_head, uint64_t seed = 1337);
+    static SharedWeights attach(const string &name);
+    static void remove(const string &name);
+
+    GPTLanguageModel model() const;
+
+    bool attached() const { return base != nullptr; }
+    const SharedModelHeader &header() const;
+    size_t mapped_bytes() const { return length; }
+    bool huge_pages() const { return hugepage_advised; }
+
+private:
+    SharedWeights(void *base, size_t length, bool hugepage_advised);
+
+    void *base;
+    size_t length;
+    bool hugepage_advised;
+};
+
+#endif // SHAREDWEIGHTS_HPP
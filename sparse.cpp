@@ -0,0 +1,197 @@
+#include "./sparse.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include "./fixedkernels.hpp"
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SPARSE_AVX2_DISPATCH
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+    // Sparse dot product of one compressed row with x; N and M fixed so the
+    // group index is a shift and the inner loop unrolls
+    template <int N, int M>
+    double sparse_dot(const double *v, const uint8_t *off, size_t count, const double *x)
+    {
+        constexpr int lanes = fixedshape::lanes;
+        double acc[lanes] = {};
+        size_t j = 0;
+        for (; j + lanes <= count; j += lanes)
+        {
+            for (int k = 0; k < lanes; ++k)
+            {
+                acc[k] += v[j + k] * x[(j + k) / N * M + off[j + k]];
+            }
+        }
+        double sum = 0.0;
+        for (; j < count; ++j)
+        {
+            sum += v[j] * x[j / N * M + off[j]];
+        }
+        for (int k = 0; k < lanes; ++k)
+        {
+            sum += acc[k];
+        }
+        return sum;
+    }
+
+    double sparse_dot(const double *v, const uint8_t *off, size_t count, const double *x, int n, int m)
+    {
+        double sum = 0.0;
+        for (size_t j = 0; j < count; ++j)
+        {
+            sum += v[j] * x[j / n * m + off[j]];
+        }
+        return sum;
+    }
+
+#ifdef SPARSE_AVX2_DISPATCH
+    // 2:4 with AVX2: four kept values cover two groups, so their input
+    // indices are {4g, 4g, 4g + 4, 4g + 4} plus the four offset bytes.
+    // Compiled for AVX2 regardless of -march and only called when the CPU has it.
+    __attribute__((target("avx2,fma"))) double sparse_dot_2_4_avx2(const double *v, const uint8_t *off, size_t count,
+                                                                   const double *x)
+    {
+        __m256d acc0 = _mm256_setzero_pd();
+        __m256d acc1 = _mm256_setzero_pd();
+        __m128i base = _mm_setr_epi32(0, 0, 4, 4);
+        const __m128i step = _mm_set1_epi32(8);
+        const __m256d all_lanes = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        size_t j = 0;
+        for (; j + 8 <= count; j += 8)
+        {
+            int32_t o0, o1;
+            memcpy(&o0, off + j, 4);
+            memcpy(&o1, off + j + 4, 4);
+            __m128i i0 = _mm_add_epi32(base, _mm_cvtepu8_epi32(_mm_cvtsi32_si128(o0)));
+            __m128i i1 = _mm_add_epi32(_mm_add_epi32(base, step), _mm_cvtepu8_epi32(_mm_cvtsi32_si128(o1)));
+            // Masked form with a zero source: the unmasked intrinsic reads an
+            // uninitialized source and trips -Wmaybe-uninitialized
+            __m256d x0 = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), x, i0, all_lanes, 8);
+            __m256d x1 = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), x, i1, all_lanes, 8);
+            acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(v + j), x0, acc0);
+            acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(v + j + 4), x1, acc1);
+            base = _mm_add_epi32(base, _mm_add_epi32(step, step));
+        }
+        alignas(32) double lane[4];
+        _mm256_store_pd(lane, _mm256_add_pd(acc0, acc1));
+        double sum = lane[0] + lane[1] + lane[2] + lane[3];
+        for (; j < count; ++j)
+        {
+            sum += v[j] * x[j / 2 * 4 + off[j]];
+        }
+        return sum;
+    }
+
+    bool cpu_has_avx2()
+    {
+        static const bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        return has;
+    }
+#endif
+}
+
+SparseWeights::SparseWeights(size_t rows, size_t cols, int n, int m) : n_rows(rows), n_cols(cols), keep(n), group(m)
+{
+    values.reserve(rows * (cols / m) * n);
+    offsets.reserve(rows * (cols / m) * n);
+}
+
+void SparseWeights::check_pattern(int n, int m, size_t cols)
+{
+    if (n <= 0 || m < n || m > 256 || cols % m != 0)
+    {
+        throw invalid_argument("SparseWeights::prune: " + to_string(n) + ":" + to_string(m) +
+                               " does not fit rows of " + to_string(cols) + " weights");
+    }
+}
+
+SparseWeights SparseWeights::prune(const Parameter &dense, int n, int m)
+{
+    check_pattern(n, m, dense.cols());
+    SparseWeights sparse(dense.rows(), dense.cols(), n, m);
+    vector<int> order(m);
+    for (size_t r = 0; r < dense.rows(); ++r)
+    {
+        const double *w = dense.row(r);
+        for (size_t g = 0; g < dense.cols(); g += m)
+        {
+            // Largest magnitudes first, ties to the lower column; kept in column order
+            iota(order.begin(), order.end(), 0);
+            partial_sort(order.begin(), order.begin() + n, order.end(), [&](int a, int b)
+                         { return fabs(w[g + a]) > fabs(w[g + b]) || (fabs(w[g + a]) == fabs(w[g + b]) && a < b); });
+            sort(order.begin(), order.begin() + n);
+            for (int k = 0; k < n; ++k)
+            {
+                sparse.values.push_back(w[g + order[k]]);
+                sparse.offsets.push_back(static_cast<uint8_t>(order[k]));
+            }
+        }
+    }
+    return sparse;
+}
+
+void SparseWeights::forward(const double *x, const double *b, double *y) const
+{
+    size_t per_row = n_cols / group * keep;
+    bool avx2 = false;
+#ifdef SPARSE_AVX2_DISPATCH
+    avx2 = cpu_has_avx2();
+#endif
+    for (size_t r = 0; r < n_rows; ++r)
+    {
+        const double *v = values.data() + r * per_row;
+        const uint8_t *off = offsets.data() + r * per_row;
+        double sum;
+        if (keep == 2 && group == 4)
+        {
+#ifdef SPARSE_AVX2_DISPATCH
+            sum = avx2 ? sparse_dot_2_4_avx2(v, off, per_row, x) : sparse_dot<2, 4>(v, off, per_row, x);
+#else
+            sum = sparse_dot<2, 4>(v, off, per_row, x);
+#endif
+        }
+        else if (keep == 1 && group == 4)
+        {
+            sum = sparse_dot<1, 4>(v, off, per_row, x);
+        }
+        else if (keep == 4 && group == 8)
+        {
+            sum = sparse_dot<4, 8>(v, off, per_row, x);
+        }
+        else
+        {
+            sum = sparse_dot(v, off, per_row, x, keep, group);
+        }
+        y[r] = sum + b[r];
+    }
+}
+
+Parameter SparseWeights::to_dense() const
+{
+    Parameter dense(n_rows, n_cols);
+    size_t per_row = n_cols / group * keep;
+    for (size_t r = 0; r < n_rows; ++r)
+    {
+        for (size_t j = 0; j < per_row; ++j)
+        {
+            size_t i = r * per_row + j;
+            dense.row(r)[j / keep * group + offsets[i]] = values[i];
+        }
+    }
+    return dense;
+}
+
+ModuleMemory SparseWeights::memory_usage(const string &name) const
+{
+    size_t payload = values.size() * sizeof(double);
+    size_t total = sizeof(SparseWeights) + memory::allocation_bytes(values.capacity() * sizeof(double)) +
+                   memory::allocation_bytes(offsets.capacity());
+    return {name, values.size(), payload, total - payload, 0};
+}
@@ -0,0 +1,59 @@
+#ifndef SPARSE_HPP
+#define SPARSE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "./memory.hpp"
+#include "./parameter.hpp"
+
+using namespace std;
+
+// N:M structured-sparse weights for Linear (see Linear::prune).
+//
+// prune() keeps the n largest-magnitude weights of every group of m
+// consecutive weights in a row (2:4 by default) and stores only those:
+// `values` holds the kept weights row by row, and `offsets` holds each
+// kept weight's position inside its group, one byte each. A rows x cols
+// matrix shrinks to rows * cols / m * n values plus as many offset bytes.
+//
+// forward() touches only the kept weights. On x86-64 CPUs with AVX2 the 2:4
+// path gathers the matching inputs four at a time (chosen at run time, no
+// -march needed); otherwise it keeps fixedshape::lanes partial sums like the
+// dense fixed kernels.
+
+class SparseWeights
+{
+public:
+    // Throws invalid_argument unless 0 < n <= m <= 256 and m divides cols
+    static void check_pattern(int n, int m, size_t cols);
+    static SparseWeights prune(const Parameter &dense, int n = 2, int m = 4);
+
+    // y = W x + b for one input vector of cols() values
+    void forward(const double *x, const double *b, double *y) const;
+
+    // Dense rows x cols copy with the pruned weights zeroed
+    Parameter to_dense() const;
+
+    size_t rows() const { return n_rows; }
+    size_t cols() const { return n_cols; }
+    int n() const { return keep; }
+    int m() const { return group; }
+    size_t nonzeros() const { return values.size(); }
+
+    // Kept values as payload; offsets and vector headers as overhead
+    ModuleMemory memory_usage(const string &name) const;
+
+private:
+    SparseWeights(size_t rows, size_t cols, int n, int m);
+
+    size_t n_rows;
+    size_t n_cols;
+    int keep;
+    int group;
+    vector<double> values;  // rows x (cols / m * n)
+    vector<uint8_t> offsets; // parallel to values
+};
+
+#endif // SPARSE_HPP
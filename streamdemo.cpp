@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stop_token>
+#include <string>
+#include <vector>
+#include "./fixedkernels.hpp"
+#include "./multiheadedgpt.hpp"
+#include "./tokenstream.hpp"
+#include "./util.hpp"
+
+using namespace std;
+
+// Time to first token against total latency for blocking generate(), one
+// pulled TokenStream, and several streams multiplexed on a thread pool with
+// early-stop tokens and cancellation.
+
+using Clock = chrono::steady_clock;
+
+static double ms_since(Clock::time_point start)
+{
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+struct StreamStats
+{
+    string label;
+    int tokens = 0;
+    double first_ms = -1.0;
+    double total_ms = 0.0;
+    string ended;
+};
+
+static void printStats(ostream &out, const vector<StreamStats> &stats)
+{
+    out << left << setw(24) << "stream" << right << setw(8) << "tokens" << setw(12) << "ttft ms" << setw(12)
+        << "total ms" << "  ended by" << endl;
+    ios saved(nullptr);
+    saved.copyfmt(out);
+    for (const auto &s : stats)
+    {
+        out << left << setw(24) << s.label << right << setw(8) << s.tokens << fixed << setprecision(1) << setw(12)
+            << s.first_ms << setw(12) << s.total_ms << "  " << s.ended << endl;
+    }
+    out.copyfmt(saved);
+}
+
+static void usage()
+{
+    cerr << "usage: streamdemo [options]\n"
+         << "  --quick              divide the util.cpp model defaults by 4\n"
+         << "  --streams N          concurrent streams in the pooled run (default 4)\n"
+         << "  --threads N          executor threads (default 2)\n"
+         << "  --max_new_tokens N   tokens per stream (default 8)\n"
+         << "  --prompt_len N       prompt tokens per stream (default 5)\n"
+         << "  --vocab_size N       synthetic vocabulary size (default 2048)\n";
+}
+
+int main(int argc, char **argv)
+{
+    int C = n_embd, L = n_layer, T = block_size;
+    int streams = 4;
+    int threads = 2;
+    int max_new_tokens = 8;
+    int prompt_len = 5;
+    int vocab = 2048;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--quick")
+        {
+            C = max(n_head, n_embd / 4);
+            L = max(1, n_layer / 4);
+            T = max(1, block_size / 4);
+            continue;
+        }
+        if (arg == "--help" || i + 1 >= argc)
+        {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+        string value = argv[++i];
+        if (arg == "--streams") streams = max(1, stoi(value));
+        else if (arg == "--threads") threads = max(1, stoi(value));
+        else if (arg == "--max_new_tokens") max_new_tokens = stoi(value);
+        else if (arg == "--prompt_len") prompt_len = max(1, stoi(value));
+        else if (arg == "--vocab_size") vocab = stoi(value);
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    // Specialize the --quick shape as well as the built-in production one
+    fixedshape::register_model<96, 6>();
+
+    // Keep the model's construction chatter out of the report
+    ostream report(cout.rdbuf());
+    ostringstream chatter;
+    cout.rdbuf(chatter.rdbuf());
+
+    GPTLanguageModel gpt(vocab, C, T, L, n_head);
+    mt19937 gen(42);
+    uniform_int_distribution<> pick(0, vocab - 1);
+    auto prompt = [&]()
+    {
+        vector<int> p(prompt_len);
+        generate(p.begin(), p.end(), [&]()
+                 { return pick(gen); });
+        return vector<vector<int>>{p};
+    };
+
+    report << "model: vocab " << vocab << ", n_embd " << C << ", n_head " << n_head << ", n_layer " << L
+           << ", block_size " << T << "; " << max_new_tokens << " new tokens per stream" << endl
+           << endl;
+
+    vector<StreamStats> single(2);
+
+    // Blocking: nothing is visible until the last token
+    {
+        auto idx = prompt();
+        auto start = Clock::now();
+        gpt.generate(idx, max_new_tokens);
+        single[0] = {"generate()", max_new_tokens, ms_since(start), ms_since(start), "max_new_tokens"};
+    }
+
+    // Pulled stream: each token is visible as soon as its step finishes
+    {
+        GenerateOptions options;
+        options.max_new_tokens = max_new_tokens;
+        auto start = Clock::now();
+        StreamStats &s = single[1];
+        s.label = "stream()";
+        for (const TokenEvent &event : gpt.stream(prompt(), options))
+        {
+            (void)event;
+            if (s.first_ms < 0.0)
+            {
+                s.first_ms = ms_since(start);
+            }
+            ++s.tokens;
+        }
+        s.total_ms = ms_since(start);
+        s.ended = "max_new_tokens";
+    }
+    printStats(report, single);
+    report << endl;
+
+    // Pooled: stream 0 runs to max_new_tokens, stream 1 is cancelled after its
+    // second token and the rest stop early on any of the lowest vocab/8 ids
+    vector<int> stop_tokens;
+    for (int t = 0; t < max(1, vocab / 8); ++t)
+    {
+        stop_tokens.push_back(t);
+    }
+    vector<StreamStats> pooled(streams);
+    vector<stop_source> cancels(streams);
+    vector<StreamTask> tasks;
+    {
+        ThreadPoolExecutor executor(threads);
+        auto start = Clock::now();
+        for (int i = 0; i < streams; ++i)
+        {
+            GenerateOptions options;
+            options.max_new_tokens = max_new_tokens;
+            options.cancel = cancels[i].get_token();
+            if (i >= 2)
+            {
+                options.stop_tokens = stop_tokens;
+            }
+            StreamStats &s = pooled[i];
+            s.label = "stream_async #" + to_string(i);
+            stop_source &cancel = cancels[i];
+            tasks.push_back(gpt.stream_async(prompt(), options, executor,
+                                             [&s, &cancel, &stop_tokens, start, i](const TokenEvent &event)
+                                             {
+                                                 if (s.first_ms < 0.0)
+                                                 {
+                                                     s.first_ms = ms_since(start);
+                                                 }
+                                                 s.total_ms = ms_since(start);
+                                                 ++s.tokens;
+                                                 if (i == 1 && s.tokens == 2)
+                                                 {
+                                                     cancel.request_stop();
+                                                 }
+                                                 if (i >= 2 && find(stop_tokens.begin(), stop_tokens.end(), event.token) != stop_tokens.end())
+                                                 {
+                                                     s.ended = "stop token " + to_string(event.token);
+                                                 }
+                                             }));
+        }
+        for (auto &task : tasks)
+        {
+            task.wait();
+        }
+        double wall_ms = ms_since(start);
+        for (int i = 0; i < streams; ++i)
+        {
+            if (pooled[i].ended.empty())
+            {
+                pooled[i].ended = cancels[i].stop_requested() ? "cancel" : "max_new_tokens";
+            }
+        }
+        ios saved(nullptr);
+        saved.copyfmt(report);
+        report << streams << " streams on " << threads << " executor threads (wall " << fixed << setprecision(1)
+               << wall_ms << " ms):" << endl;
+        report.copyfmt(saved);
+        printStats(report, pooled);
+    }
+    cout.rdbuf(report.rdbuf());
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include "./tokenstream.hpp"
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+TokenStream::TokenStream(TokenStream &&other) noexcept : handle(exchange(other.handle, nullptr)) {}
+
+TokenStream &TokenStream::operator=(TokenStream &&other) noexcept
+{
+    if (this != &other)
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+        handle = exchange(other.handle, nullptr);
+    }
+    return *this;
+}
+
+TokenStream::~TokenStream()
+{
+    if (handle)
+    {
+        handle.destroy();
+    }
+}
+
+bool TokenStream::next()
+{
+    if (!handle || handle.done())
+    {
+        return false;
+    }
+    handle.resume();
+    if (handle.promise().error)
+    {
+        rethrow_exception(exchange(handle.promise().error, nullptr));
+    }
+    return !handle.done();
+}
+
+bool TokenStream::done() const
+{
+    return !handle || handle.done();
+}
+
+const TokenEvent &TokenStream::value() const
+{
+    return handle.promise().current;
+}
+
+TokenStream::iterator TokenStream::begin()
+{
+    next();
+    return iterator(this);
+}
+
+ThreadPoolExecutor::ThreadPoolExecutor(int threads)
+{
+    for (int i = 0; i < max(1, threads); ++i)
+    {
+        workers.emplace_back(&ThreadPoolExecutor::run, this);
+    }
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPoolExecutor::post(coroutine_handle<> handle)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        queue.push_back(handle);
+    }
+    ready.notify_one();
+}
+
+void ThreadPoolExecutor::run()
+{
+    for (;;)
+    {
+        coroutine_handle<> handle;
+        {
+            unique_lock<mutex> guard(lock);
+            ready.wait(guard, [this] { return stopping || !queue.empty(); });
+            if (queue.empty())
+            {
+                return;
+            }
+            handle = queue.front();
+            queue.pop_front();
+        }
+        handle.resume();
+    }
+}
+
+void StreamTask::promise_type::FinalAwaiter::await_suspend(coroutine_handle<promise_type> handle) noexcept
+{
+    // The frame is suspended here, so a waiter may destroy it as soon as the lock is released
+    promise_type &promise = handle.promise();
+    lock_guard<mutex> guard(promise.lock);
+    promise.finished = true;
+    promise.finished_cv.notify_all();
+}
+
+StreamTask::StreamTask(StreamTask &&other) noexcept : handle(exchange(other.handle, nullptr)) {}
+
+StreamTask &StreamTask::operator=(StreamTask &&other) noexcept
+{
+    if (this != &other)
+    {
+        if (handle)
+        {
+            wait_and_destroy();
+        }
+        handle = exchange(other.handle, nullptr);
+    }
+    return *this;
+}
+
+StreamTask::~StreamTask()
+{
+    if (handle)
+    {
+        wait_and_destroy();
+    }
+}
+
+void StreamTask::wait()
+{
+    wait_finished();
+    promise_type &promise = handle.promise();
+    if (promise.error)
+    {
+        rethrow_exception(exchange(promise.error, nullptr));
+    }
+}
+
+bool StreamTask::done()
+{
+    promise_type &promise = handle.promise();
+    lock_guard<mutex> guard(promise.lock);
+    return promise.finished;
+}
+
+void StreamTask::wait_finished()
+{
+    promise_type &promise = handle.promise();
+    unique_lock<mutex> guard(promise.lock);
+    promise.finished_cv.wait(guard, [&promise] { return promise.finished; });
+}
+
+void StreamTask::wait_and_destroy()
+{
+    wait_finished();
+    handle.destroy();
+    handle = nullptr;
+}
@@ -0,0 +1,192 @@
+#ifndef TOKENSTREAM_HPP
+#define TOKENSTREAM_HPP
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Coroutine types behind GPTLanguageModel::stream() and stream_async().
+//
+// A stream runs one decode step at a time over the sequences that are still
+// active and hands out every sampled token as soon as its step finishes.
+// Sequences that emit a stop token drop out of later steps, and a stream
+// whose stop_token is triggered ends before its next step.
+
+// One sampled token: which sequence of the batch it extends and at which
+// decode step (0-based) it was produced
+struct TokenEvent
+{
+    int sequence;
+    int token;
+    int step;
+};
+
+struct GenerateOptions
+{
+    int max_new_tokens = 0;
+    vector<int> stop_tokens; // a sequence finishes after emitting any of these
+    stop_token cancel;       // checked before every decode step
+};
+
+// Pull-style generator: each advance resumes the coroutine until the next
+// token. Destroying the stream mid-way abandons the remaining steps.
+class TokenStream
+{
+public:
+    struct promise_type
+    {
+        TokenEvent current{};
+        exception_ptr error;
+
+        TokenStream get_return_object() { return TokenStream(coroutine_handle<promise_type>::from_promise(*this)); }
+        suspend_always initial_suspend() noexcept { return {}; }
+        suspend_always final_suspend() noexcept { return {}; }
+        suspend_always yield_value(const TokenEvent &event) noexcept
+        {
+            current = event;
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() { error = current_exception(); }
+    };
+
+    class iterator
+    {
+    public:
+        using iterator_category = input_iterator_tag;
+        using value_type = TokenEvent;
+        using difference_type = ptrdiff_t;
+
+        iterator() = default;
+        explicit iterator(TokenStream *stream) : stream(stream) {}
+        const TokenEvent &operator*() const { return stream->value(); }
+        iterator &operator++()
+        {
+            stream->next();
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+        bool operator==(default_sentinel_t) const { return stream == nullptr || stream->done(); }
+
+    private:
+        TokenStream *stream = nullptr;
+    };
+
+    TokenStream(TokenStream &&other) noexcept;
+    TokenStream &operator=(TokenStream &&other) noexcept;
+    TokenStream(const TokenStream &) = delete;
+    TokenStream &operator=(const TokenStream &) = delete;
+    ~TokenStream();
+
+    // Runs to the next token; false once the stream is finished.
+    // Rethrows anything the generation step threw.
+    bool next();
+    bool done() const;
+    const TokenEvent &value() const;
+
+    iterator begin();
+    default_sentinel_t end() { return default_sentinel; }
+
+private:
+    explicit TokenStream(coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    coroutine_handle<promise_type> handle;
+};
+
+// Where async streams run their decode steps. `co_await executor.schedule()`
+// suspends the caller and hands it to post(), which must eventually resume
+// it on some thread exactly once.
+class Executor
+{
+public:
+    virtual ~Executor() = default;
+    virtual void post(coroutine_handle<> handle) = 0;
+
+    struct ScheduleAwaiter
+    {
+        Executor &executor;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(coroutine_handle<> handle) { executor.post(handle); }
+        void await_resume() const noexcept {}
+    };
+
+    ScheduleAwaiter schedule() { return ScheduleAwaiter{*this}; }
+};
+
+// Fixed set of worker threads resuming posted coroutines in FIFO order, so
+// streams that reschedule after every step share the workers round-robin.
+// The destructor runs whatever is still queued, then joins.
+class ThreadPoolExecutor : public Executor
+{
+public:
+    explicit ThreadPoolExecutor(int threads);
+    ~ThreadPoolExecutor() override;
+    ThreadPoolExecutor(const ThreadPoolExecutor &) = delete;
+    ThreadPoolExecutor &operator=(const ThreadPoolExecutor &) = delete;
+
+    void post(coroutine_handle<> handle) override;
+
+private:
+    void run();
+
+    mutex lock;
+    condition_variable ready;
+    deque<coroutine_handle<>> queue;
+    bool stopping = false;
+    vector<thread> workers;
+};
+
+// Handle to a stream started with stream_async(). The coroutine starts on
+// the calling thread and moves to its executor before the first step.
+// Destroying the task waits for the stream to finish.
+class StreamTask
+{
+public:
+    struct promise_type
+    {
+        mutex lock;
+        condition_variable finished_cv;
+        bool finished = false;
+        exception_ptr error;
+
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(coroutine_handle<promise_type> handle) noexcept;
+            void await_resume() const noexcept {}
+        };
+
+        StreamTask get_return_object() { return StreamTask(coroutine_handle<promise_type>::from_promise(*this)); }
+        suspend_never initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() { error = current_exception(); }
+    };
+
+    StreamTask(StreamTask &&other) noexcept;
+    StreamTask &operator=(StreamTask &&other) noexcept;
+    StreamTask(const StreamTask &) = delete;
+    StreamTask &operator=(const StreamTask &) = delete;
+    ~StreamTask();
+
+    // Blocks until the stream finishes; rethrows anything the stream threw
+    void wait();
+    bool done();
+
+private:
+    explicit StreamTask(coroutine_handle<promise_type> handle) : handle(handle) {}
+    void wait_finished();
+    void wait_and_destroy();
+
+    coroutine_handle<promise_type> handle;
+};
+
+#endif // TOKENSTREAM_HPP
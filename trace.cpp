@@ -0,0 +1,208 @@
+#include "./trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+TraceRing::TraceRing(int tid) : thread_id(tid), events(capacity), head(0) {}
+
+void TraceRing::push(const TraceEvent &event)
+{
+    // Only the owning thread writes, so a relaxed load of head is enough
+    uint64_t h = head.load(memory_order_relaxed);
+    events[h & (capacity - 1)] = event;
+    head.store(h + 1, memory_order_release);
+}
+
+vector<TraceEvent> TraceRing::snapshot() const
+{
+    uint64_t h = head.load(memory_order_acquire);
+    uint64_t count = min<uint64_t>(h, capacity);
+    vector<TraceEvent> out;
+    out.reserve(count);
+    for (uint64_t i = h - count; i < h; ++i)
+    {
+        out.push_back(events[i & (capacity - 1)]);
+    }
+    return out;
+}
+
+void TraceRing::clear()
+{
+    head.store(0, memory_order_release);
+}
+
+uint64_t TraceRing::dropped() const
+{
+    uint64_t h = head.load(memory_order_acquire);
+    return h > capacity ? h - capacity : 0;
+}
+
+namespace
+{
+    struct ScopeTotals
+    {
+        uint64_t calls = 0;
+        uint64_t inclusive_ns = 0;
+        uint64_t child_ns = 0;
+        double flops = 0.0;
+        double bytes = 0.0;
+    };
+
+    // Everything one thread records. Totals are keyed by the scope's name
+    // literal; open holds the child time of each scope still running.
+    struct ThreadTrace
+    {
+        explicit ThreadTrace(int tid) : ring(tid) {}
+        TraceRing ring;
+        unordered_map<const char *, ScopeTotals> totals;
+        vector<uint64_t> open;
+    };
+
+    // Outlive their threads so a trace can be exported after workers exit
+    mutex registry_mutex;
+    vector<shared_ptr<ThreadTrace>> registry;
+
+    const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+    ThreadTrace &local_trace()
+    {
+        thread_local ThreadTrace *local = nullptr;
+        if (local == nullptr)
+        {
+            lock_guard<mutex> lock(registry_mutex);
+            registry.push_back(make_shared<ThreadTrace>(static_cast<int>(registry.size())));
+            local = registry.back().get();
+        }
+        return *local;
+    }
+
+    vector<shared_ptr<ThreadTrace>> threads()
+    {
+        lock_guard<mutex> lock(registry_mutex);
+        return registry;
+    }
+}
+
+namespace trace
+{
+    uint64_t now_ns()
+    {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+    }
+
+    void enter()
+    {
+        local_trace().open.push_back(0);
+    }
+
+    void record(const char *name, uint64_t start_ns, uint64_t end_ns, double flops, double bytes)
+    {
+        ThreadTrace &t = local_trace();
+        uint64_t duration = end_ns - start_ns;
+        uint64_t child_ns = 0;
+        if (!t.open.empty())
+        {
+            child_ns = t.open.back();
+            t.open.pop_back();
+        }
+        if (!t.open.empty())
+        {
+            t.open.back() += duration;
+        }
+        ScopeTotals &totals = t.totals[name];
+        totals.calls += 1;
+        totals.inclusive_ns += duration;
+        totals.child_ns += child_ns;
+        totals.flops += flops;
+        totals.bytes += bytes;
+        t.ring.push({name, start_ns, end_ns, flops, bytes});
+    }
+
+    void write_chrome_trace(const string &filename)
+    {
+        ofstream out(filename);
+        out << setprecision(12);
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        for (const auto &t : threads())
+        {
+            for (const auto &e : t->ring.snapshot())
+            {
+                out << (first ? "" : ",\n");
+                first = false;
+                out << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << t->ring.tid()
+                    << ",\"ts\":" << e.start_ns / 1e3 << ",\"dur\":" << (e.end_ns - e.start_ns) / 1e3
+                    << ",\"args\":{\"flops\":" << e.flops << ",\"bytes\":" << e.bytes << "}}";
+            }
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    }
+
+    void print_summary(ostream &out)
+    {
+        // Scopes with the same name from different threads and call sites are merged
+        map<string, ScopeTotals> totals;
+        uint64_t dropped = 0;
+        for (const auto &t : threads())
+        {
+            dropped += t->ring.dropped();
+            for (const auto &[name, s] : t->totals)
+            {
+                ScopeTotals &merged = totals[name];
+                merged.calls += s.calls;
+                merged.inclusive_ns += s.inclusive_ns;
+                merged.child_ns += s.child_ns;
+                merged.flops += s.flops;
+                merged.bytes += s.bytes;
+            }
+        }
+
+        auto self_ns = [](const ScopeTotals &t)
+        { return static_cast<double>(t.inclusive_ns - t.child_ns); };
+        vector<pair<string, ScopeTotals>> rows(totals.begin(), totals.end());
+        sort(rows.begin(), rows.end(), [&](const auto &a, const auto &b)
+             { return self_ns(a.second) > self_ns(b.second); });
+        double all_self_ns = 0.0;
+        for (const auto &row : rows)
+        {
+            all_self_ns += self_ns(row.second);
+        }
+
+        ios saved(nullptr);
+        saved.copyfmt(out);
+        out << left << setw(36) << "scope" << right << setw(10) << "calls" << setw(12) << "total ms"
+            << setw(12) << "self ms" << setw(8) << "self%" << setw(10) << "GFLOP/s" << setw(10) << "GB/s" << endl;
+        for (const auto &[name, t] : rows)
+        {
+            double seconds = t.inclusive_ns / 1e9;
+            out << left << setw(36) << name << right << setw(10) << t.calls << fixed << setprecision(3)
+                << setw(12) << t.inclusive_ns / 1e6 << setw(12) << self_ns(t) / 1e6 << setprecision(1)
+                << setw(7) << (all_self_ns > 0 ? 100.0 * self_ns(t) / all_self_ns : 0.0) << "%" << setprecision(2)
+                << setw(10) << (seconds > 0 ? t.flops / seconds / 1e9 : 0.0)
+                << setw(10) << (seconds > 0 ? t.bytes / seconds / 1e9 : 0.0) << endl;
+        }
+        out.copyfmt(saved);
+        if (dropped > 0)
+        {
+            out << "(" << dropped << " events overwritten in the Chrome trace, which keeps the most recent "
+                << TraceRing::capacity << " per thread; the totals above are exact)" << endl;
+        }
+    }
+
+    void reset()
+    {
+        lock_guard<mutex> lock(registry_mutex);
+        for (auto &t : registry)
+        {
+            t->ring.clear();
+            t->totals.clear();
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Scoped trace points for the forward/generate hot paths.
+//
+// Build with -DGPT_TRACE (CMake option GPT_ENABLE_TRACE) to enable them.
+// Without it TRACE_SCOPE expands to nothing, so neither the timestamps nor
+// the FLOP/byte arguments are evaluated.
+//
+// Each thread keeps exact per-scope totals for print_summary() and appends
+// every event to its own fixed-size ring buffer for the Chrome export; the
+// hot path never takes a lock. When a ring wraps, the oldest events are
+// overwritten in the export only. Scopes must nest on their thread, so do not
+// hold one across a coroutine suspension. Export once the traced threads are
+// idle.
+
+struct TraceEvent
+{
+    const char *name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    double flops;
+    double bytes;
+};
+
+class TraceRing
+{
+public:
+    static constexpr size_t capacity = 1 << 16;
+
+    explicit TraceRing(int tid);
+    void push(const TraceEvent &event);
+    vector<TraceEvent> snapshot() const;
+    uint64_t dropped() const;
+    void clear();
+    int tid() const { return thread_id; }
+
+private:
+    int thread_id;
+    vector<TraceEvent> events;
+    atomic<uint64_t> head;
+};
+
+namespace trace
+{
+    uint64_t now_ns();
+
+    // enter() opens a scope on the calling thread; record() closes the
+    // innermost open one, adding it to the totals and the ring
+    void enter();
+    void record(const char *name, uint64_t start_ns, uint64_t end_ns, double flops, double bytes);
+
+    // Chrome trace-event JSON, loadable in chrome://tracing or Perfetto
+    void write_chrome_trace(const string &filename);
+
+    // Per-scope totals: calls, inclusive and self time, GFLOP/s and GB/s.
+    // Exact however many events the rings have dropped.
+    void print_summary(ostream &out);
+
+    // Discard recorded events; like export, only call while traced threads are idle
+    void reset();
+}
+
+class TraceScope
+{
+public:
+    TraceScope(const char *name, double flops, double bytes)
+        : name(name), flops(flops), bytes(bytes), start_ns((trace::enter(), trace::now_ns())) {}
+    ~TraceScope() { trace::record(name, start_ns, trace::now_ns(), flops, bytes); }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name;
+    double flops;
+    double bytes;
+    uint64_t start_ns;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef GPT_TRACE
+#define TRACE_SCOPE(name, flops, bytes) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, flops, bytes)
+#else
+#define TRACE_SCOPE(name, flops, bytes) ((void)0)
+#endif
+
+#endif // TRACE_HPP
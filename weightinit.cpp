@@ -0,0 +1,152 @@
+#include "./weightinit.hpp"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <thread>
+
+using namespace std;
+
+namespace
+{
+    // Below this many elements a tensor is filled on the calling thread
+    const size_t min_parallel_elements = 1 << 15;
+
+    // Box-Muller pairs generated per batch
+    const size_t batch_pairs = 64;
+
+    struct Philox4x32
+    {
+        uint32_t v[4];
+    };
+
+    inline void mulhilo(uint32_t a, uint32_t b, uint32_t &hi, uint32_t &lo)
+    {
+        uint64_t product = static_cast<uint64_t>(a) * b;
+        hi = static_cast<uint32_t>(product >> 32);
+        lo = static_cast<uint32_t>(product);
+    }
+
+    // Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3")
+    inline Philox4x32 philox(uint64_t counter, uint64_t stream, uint64_t key)
+    {
+        uint32_t c0 = static_cast<uint32_t>(counter), c1 = static_cast<uint32_t>(counter >> 32);
+        uint32_t c2 = static_cast<uint32_t>(stream), c3 = static_cast<uint32_t>(stream >> 32);
+        uint32_t k0 = static_cast<uint32_t>(key), k1 = static_cast<uint32_t>(key >> 32);
+        for (int round = 0; round < 10; ++round)
+        {
+            uint32_t hi0, lo0, hi1, lo1;
+            mulhilo(0xD2511F53u, c0, hi0, lo0);
+            mulhilo(0xCD9E8D57u, c2, hi1, lo1);
+            c0 = hi1 ^ c1 ^ k0;
+            c1 = lo1;
+            c2 = hi0 ^ c3 ^ k1;
+            c3 = lo0;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+        return {{c0, c1, c2, c3}};
+    }
+
+    // 53 random bits mapped to (0, 1], so log() never sees zero
+    inline double to_unit(uint32_t hi, uint32_t lo)
+    {
+        uint64_t bits = ((static_cast<uint64_t>(hi) << 32) | lo) >> 11;
+        return (bits + 1) * (1.0 / 9007199254740992.0);
+    }
+
+    // Split [0, n) into contiguous ranges and run fn(begin, end) on each
+    template <typename F>
+    void parallel_ranges(size_t n, int n_threads, F fn)
+    {
+        size_t workers = min<size_t>(n_threads, max<size_t>(1, n / min_parallel_elements));
+        if (workers <= 1)
+        {
+            fn(0, n);
+            return;
+        }
+        vector<thread> threads;
+        size_t chunk = (n + workers - 1) / workers;
+        for (size_t begin = 0; begin < n; begin += chunk)
+        {
+            threads.emplace_back(fn, begin, min(n, begin + chunk));
+        }
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+}
+
+WeightInit::WeightInit(uint64_t seed, int n_threads)
+    : master_seed(seed), n_threads(n_threads > 0 ? n_threads : max(1u, thread::hardware_concurrency())), stream_counter(0)
+{
+}
+
+uint64_t WeightInit::next_stream()
+{
+    return stream_counter.fetch_add(1, memory_order_relaxed);
+}
+
+void WeightInit::fill_normal(double *out, size_t n, uint64_t seed, uint64_t stream, uint64_t offset,
+                             double mean, double stddev)
+{
+    if (n == 0)
+    {
+        return;
+    }
+    const double two_pi = 6.283185307179586;
+    double u1[batch_pairs], u2[batch_pairs];
+
+    // Element i of the stream is half of Box-Muller pair i / 2
+    uint64_t first_pair = offset / 2;
+    uint64_t end_pair = (offset + n + 1) / 2;
+    for (uint64_t base = first_pair; base < end_pair; base += batch_pairs)
+    {
+        size_t count = min<uint64_t>(batch_pairs, end_pair - base);
+        for (size_t k = 0; k < count; ++k)
+        {
+            Philox4x32 r = philox(base + k, stream, seed);
+            u1[k] = to_unit(r.v[0], r.v[1]);
+            u2[k] = to_unit(r.v[2], r.v[3]);
+        }
+        // log/sin/cos stay scalar libm calls: a vector math library would
+        // tie the weights to the build's instruction set
+        for (size_t k = 0; k < count; ++k)
+        {
+            double radius = sqrt(-2.0 * log(u1[k]));
+            uint64_t even = 2 * (base + k);
+            if (even >= offset && even < offset + n)
+            {
+                out[even - offset] = mean + stddev * radius * cos(two_pi * u2[k]);
+            }
+            if (even + 1 >= offset && even + 1 < offset + n)
+            {
+                out[even + 1 - offset] = mean + stddev * radius * sin(two_pi * u2[k]);
+            }
+        }
+    }
+}
+
+void WeightInit::fill(double *out, size_t n, uint64_t stream, double mean, double stddev) const
+{
+    parallel_ranges(n, n_threads, [&](size_t begin, size_t end)
+                    { fill_normal(out + begin, end - begin, master_seed, stream, begin, mean, stddev); });
+}
+
+Parameter WeightInit::normal(size_t rows, size_t cols, double mean, double stddev)
+{
+    Parameter p(rows, cols);
+    fill(p.data(), p.size(), next_stream(), mean, stddev);
+    return p;
+}
+
+Parameter WeightInit::constant(size_t rows, size_t cols, double value)
+{
+    return Parameter(rows, cols, value);
+}
+
+WeightInit &WeightInit::global()
+{
+    static WeightInit init((static_cast<uint64_t>(random_device{}()) << 32) | random_device{}());
+    return init;
+}
@@ -0,0 +1,55 @@
+#ifndef WEIGHTINIT_HPP
+#define WEIGHTINIT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "./parameter.hpp"
+
+using namespace std;
+
+// Counter-based weight initialization.
+//
+// Every tensor draws from its own sub-stream of one master seed, and element
+// i of a sub-stream is a pure function of (seed, stream, i): a Philox4x32-10
+// block feeds a Box-Muller transform. Tensors can therefore be filled by any
+// number of threads in any order and still come out bit-identical.
+//
+// Sub-streams are handed out in construction order, so two models built with
+// the same seed and shapes have identical weights, and no two layers share
+// weights.
+
+class WeightInit
+{
+public:
+    // n_threads == 0 uses hardware_concurrency()
+    explicit WeightInit(uint64_t seed, int n_threads = 0);
+    virtual ~WeightInit() = default;
+
+    // Every parameter of a model is requested through these, in construction
+    // order. The base class allocates; subclasses may place parameters
+    // elsewhere (see sharedweights.cpp).
+    virtual Parameter normal(size_t rows, size_t cols, double mean, double stddev);
+    virtual Parameter constant(size_t rows, size_t cols, double value);
+
+    uint64_t next_stream();
+    uint64_t seed() const { return master_seed; }
+
+    // Elements [offset, offset + n) of sub-stream `stream`
+    static void fill_normal(double *out, size_t n, uint64_t seed, uint64_t stream, uint64_t offset,
+                            double mean, double stddev);
+
+    // Used by layers constructed outside a model; seeded from random_device
+    static WeightInit &global();
+
+protected:
+    // N(mean, stddev) from `stream`, split across n_threads
+    void fill(double *out, size_t n, uint64_t stream, double mean, double stddev) const;
+
+private:
+    uint64_t master_seed;
+    int n_threads;
+    atomic<uint64_t> stream_counter;
+};
+
+#endif // WEIGHTINIT_HPP